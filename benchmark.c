@@ -0,0 +1,305 @@
+// Headless benchmark for the solvers, runs a few scenarios without opening a window and times every phase of a timestep.
+//
+// Usage: benchmark [--scenario pile|bowl|cloth|rope|soft|all] [--solver brute|grid|incremental|cached|hash|threaded|jacobi|all]
+//                  [--count N] [--steps N] [--threads N] [--format csv|json]
+//
+// Every run starts from the same state, so results can be compared between solvers and versions of the engine.
+// The threaded and jacobi solvers also solve the links of the cloth, rope and soft scenarios on the threads, one color at a time.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "physics_threaded.h"
+
+#define TIMESTEP (1.0/60/3)
+#define GRAVITY 9.8
+#define ITERATIONS 2
+
+/////////////////////////////
+// Timing                  //
+/////////////////////////////
+
+long long now_ns() {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (long long)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+typedef struct PhaseTimes {
+	long long integrate;
+	long long grid_build;
+	long long narrow_phase;
+	long long constraints;
+} PhaseTimes;
+
+/////////////////////////////
+// Scenarios               //
+/////////////////////////////
+
+// incremental is the grid, updated with access_grid_update once per step instead of rebuilt every iteration
+// cached uses a ContactCache, built from the grid when it is out of date
+// jacobi is the deterministic multithreaded solver, with the grid updated like incremental
+typedef enum Solver { SOLVER_BRUTE, SOLVER_GRID, SOLVER_INCREMENTAL, SOLVER_CACHED, SOLVER_HASH, SOLVER_THREADED, SOLVER_JACOBI, SOLVER_COUNT } Solver;
+const char* solver_names[] = {"brute", "grid", "incremental", "cached", "hash", "threaded", "jacobi"};
+
+typedef enum Scenario { SCENARIO_PILE, SCENARIO_BOWL, SCENARIO_CLOTH, SCENARIO_ROPE, SCENARIO_SOFT, SCENARIO_COUNT } Scenario;
+const char* scenario_names[] = {"pile", "bowl", "cloth", "rope", "soft"};
+
+// Everything needed to run a scenario
+typedef struct Setup {
+	World world;
+	Boundary boundary;
+	// Distance constraints between objects
+	DistanceConstraints links;
+	// Objects held in place, and where
+	int* pinned;
+	Vector2* pin_position;
+	int pin_count;
+	// Size of the area objects can be in, for the grids
+	float extent;
+	float max_radius;
+} Setup;
+
+// A small deterministic random number generator, so every run starts the same way
+unsigned int random_state = 1;
+float random_float() {
+	random_state = random_state * 1103515245 + 12345;
+	return (float)((random_state >> 8) & 0xffff) / 0xffff;
+}
+
+void setup_pin(Setup* s, int idx) {
+	s->pinned[s->pin_count] = idx;
+	s->pin_position[s->pin_count] = s->world.objects[idx].position;
+	s->pin_count++;
+}
+
+// A side-by-side grid of objects with links to their neighbors, used for the cloth and soft body
+void setup_sheet(Setup* s, int side, float seperation, float radius, float link_length) {
+	s->pinned = malloc(side * sizeof(int));
+	s->pin_position = malloc(side * sizeof(Vector2));
+	for (int x = 0; x < side; x++) {
+		for (int y = 0; y < side; y++) {
+			world_spawn(&s->world, (x - side / 2.0) * seperation, (side / 2.0 - y) * seperation, radius);
+			int idx = s->world.size - 1;
+			if (x != 0) distance_constraints_add(&s->links, &s->world, idx, idx - side, link_length);
+			if (y != 0) distance_constraints_add(&s->links, &s->world, idx, idx - 1, link_length);
+			if (y == 0) setup_pin(s, idx);
+		}
+	}
+}
+
+Setup setup_scenario(Scenario scenario, int count) {
+	Setup s = {.world = world_with_capacity(count), .links = distance_constraints_with_capacity(1), .pinned = 0, .pin_count = 0};
+	random_state = 1;
+	int side = (int)ceilf(sqrtf(count));
+
+	switch (scenario) {
+		case SCENARIO_PILE: {
+			// Objects dropped into a box that is about half full
+			float half = side * 0.2;
+			s.boundary = boundary_box(-half, half, -half, half);
+			s.extent = half;
+			s.max_radius = 0.1;
+			for (int i = 0; i < count; i++)
+				world_spawn(&s.world, (random_float() * 2 - 1) * half, random_float() * half, 0.1);
+			break;
+		}
+		case SCENARIO_BOWL: {
+			float radius = side * 0.6;
+			s.boundary = boundary_circle(0, 0, radius);
+			s.extent = radius;
+			s.max_radius = 0.4;
+			for (int i = 0; i < count; i++) {
+				float angle = random_float() * 2 * M_PI;
+				float distance = sqrtf(random_float()) * radius;
+				world_spawn(&s.world, cosf(angle) * distance, sinf(angle) * distance, 0.4);
+			}
+			break;
+		}
+		case SCENARIO_CLOTH:
+			s.boundary = boundary_circle(0, 0, side * 2);
+			s.extent = side * 2;
+			s.max_radius = 0.4;
+			setup_sheet(&s, side, 1, 0.4, 1.1);
+			break;
+		case SCENARIO_ROPE:
+			// A row of ropes hanging next to each other
+			s.boundary = boundary_circle(0, 0, side * 2);
+			s.extent = side * 2;
+			s.max_radius = 0.4;
+			s.pinned = malloc(side * sizeof(int));
+			s.pin_position = malloc(side * sizeof(Vector2));
+			for (int rope = 0; rope < side; rope++) {
+				for (int i = 0; i < side; i++) {
+					world_spawn(&s.world, rope - side / 2.0, side / 2.0 - i, 0.4);
+					int idx = s.world.size - 1;
+					if (i == 0) setup_pin(&s, idx);
+					else distance_constraints_add(&s.links, &s.world, idx - 1, idx, 1);
+				}
+			}
+			break;
+		case SCENARIO_SOFT:
+			s.boundary = boundary_box(-side * 0.5, side * 0.5, -side * 0.5, side * 0.5);
+			s.extent = side * 0.5;
+			s.max_radius = 0.2;
+			setup_sheet(&s, side, 0.5, 0.2, 0.5);
+			break;
+		default:
+			break;
+	}
+	// Color the links once they are all added, so they can be solved on many threads
+	if (s.links.size > 0) distance_constraints_color(&s.links, s.world.size);
+	return s;
+}
+
+void free_setup(Setup* s) {
+	world_cleanup(&s->world);
+	distance_constraints_free(&s->links);
+	free(s->pinned);
+	free(s->pin_position);
+}
+
+/////////////////////////////
+// Running                 //
+/////////////////////////////
+
+PhaseTimes run(Setup* s, Solver solver, int steps, WorkerPool* pool) {
+	PhaseTimes times = {0, 0, 0, 0};
+	World* w = &s->world;
+
+	// Grids cover the whole area objects can be in, with cells twice the largest radius
+	float cellsize = s->max_radius * 2;
+	int cells = (int)ceilf(s->extent * 2 / cellsize) + 2;
+	AccessGrid grid = new_access_grid(cells, cells, -s->extent - cellsize, -s->extent - cellsize, cellsize);
+	HashGrid hash_grid = new_hash_grid(w->size, cellsize);
+	ContactCache cache = new_contact_cache(s->max_radius);
+	JacobiCollide jacobi = new_jacobi_collide(&grid, pool);
+
+	for (int step = 0; step < steps; step++) {
+		long long start = now_ns();
+		world_apply_gravity(w, GRAVITY);
+		world_update_positions(w, TIMESTEP);
+		distance_constraints_begin_step(&s->links, TIMESTEP);
+		times.integrate += now_ns() - start;
+
+		for (int iteration = 0; iteration < ITERATIONS; iteration++) {
+			start = now_ns();
+			if (solver == SOLVER_GRID || solver == SOLVER_THREADED) access_grid_populate(w, &grid);
+			if ((solver == SOLVER_INCREMENTAL || solver == SOLVER_JACOBI) && iteration == 0) access_grid_update(w, &grid);
+			if (solver == SOLVER_CACHED && iteration == 0) contact_cache_update(w, &grid, &cache);
+			if (solver == SOLVER_HASH) hash_grid_populate(w, &hash_grid);
+			long long built = now_ns();
+			times.grid_build += built - start;
+
+			if (solver == SOLVER_BRUTE) world_collide(w);
+			if (solver == SOLVER_GRID || solver == SOLVER_INCREMENTAL) access_grid_collide(w, &grid);
+			if (solver == SOLVER_CACHED) contact_cache_collide(w, &cache);
+			if (solver == SOLVER_HASH) hash_grid_collide(w, &hash_grid);
+			if (solver == SOLVER_THREADED) access_grid_threaded_collide(w, &grid, pool);
+			if (solver == SOLVER_JACOBI) access_grid_jacobi_collide(w, &jacobi);
+			long long collided = now_ns();
+			times.narrow_phase += collided - built;
+
+			if (solver == SOLVER_THREADED || solver == SOLVER_JACOBI) distance_constraints_threaded_solve(w, &s->links, pool);
+			else distance_constraints_solve(w, &s->links);
+			for (int i = 0; i < s->pin_count; i++)
+				constrain_distance_from_point(w, s->pinned[i], s->pin_position[i].x, s->pin_position[i].y, 0);
+			for (int i = 0; i < w->size; i++)
+				constrain_boundary(w, i, &s->boundary);
+			times.constraints += now_ns() - collided;
+		}
+	}
+
+	free_access_grid(&grid);
+	free_hash_grid(&hash_grid);
+	free_contact_cache(&cache);
+	free_jacobi_collide(&jacobi);
+	return times;
+}
+
+void print_result(const char* format, int first, Scenario scenario, Solver solver, int count, int steps, int threads, PhaseTimes t) {
+	long long total = t.integrate + t.grid_build + t.narrow_phase + t.constraints;
+	if (strcmp(format, "json") == 0) {
+		printf("%s\n  {\"scenario\": \"%s\", \"solver\": \"%s\", \"bodies\": %d, \"steps\": %d, \"threads\": %d, "
+			"\"integrate_ns\": %lld, \"grid_build_ns\": %lld, \"narrow_phase_ns\": %lld, \"constraints_ns\": %lld, "
+			"\"total_ns\": %lld, \"ms_per_step\": %.4f}",
+			first ? "" : ",", scenario_names[scenario], solver_names[solver], count, steps, threads,
+			t.integrate, t.grid_build, t.narrow_phase, t.constraints, total, total / 1e6 / steps);
+	} else {
+		if (first) printf("scenario,solver,bodies,steps,threads,integrate_ns,grid_build_ns,narrow_phase_ns,constraints_ns,total_ns,ms_per_step\n");
+		printf("%s,%s,%d,%d,%d,%lld,%lld,%lld,%lld,%lld,%.4f\n",
+			scenario_names[scenario], solver_names[solver], count, steps, threads,
+			t.integrate, t.grid_build, t.narrow_phase, t.constraints, total, total / 1e6 / steps);
+	}
+}
+
+// Find a name in a list, returns count for "all" and -1 if it isn't there
+int parse_name(const char* name, const char** names, int count) {
+	if (strcmp(name, "all") == 0) return count;
+	for (int i = 0; i < count; i++)
+		if (strcmp(name, names[i]) == 0) return i;
+	return -1;
+}
+
+/////////////////////////////
+// The main function       //
+/////////////////////////////
+
+int main(int argc, char** argv) {
+	int scenario = SCENARIO_COUNT;
+	int solver = SOLVER_COUNT;
+	int count = 5000;
+	int steps = 100;
+	int threads = 4;
+	const char* format = "csv";
+
+	for (int i = 1; i < argc; i++) {
+		if (i + 1 >= argc) {
+			fprintf(stderr, "Missing value for %s\n", argv[i]);
+			return 1;
+		}
+		if (strcmp(argv[i], "--scenario") == 0) {
+			scenario = parse_name(argv[++i], scenario_names, SCENARIO_COUNT);
+		} else if (strcmp(argv[i], "--solver") == 0) {
+			solver = parse_name(argv[++i], solver_names, SOLVER_COUNT);
+		} else if (strcmp(argv[i], "--count") == 0) {
+			count = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--steps") == 0) {
+			steps = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--threads") == 0) {
+			threads = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--format") == 0) {
+			format = argv[++i];
+		} else {
+			fprintf(stderr, "Unknown option %s\n", argv[i]);
+			return 1;
+		}
+	}
+	if (scenario < 0 || solver < 0 || count < 1 || steps < 1) {
+		fprintf(stderr, "Invalid arguments\n");
+		return 1;
+	}
+
+	WorkerPool* pool = new_worker_pool(threads);
+	int first = 1;
+	if (strcmp(format, "json") == 0) printf("[");
+
+	for (int sc = 0; sc < SCENARIO_COUNT; sc++) {
+		if (scenario != SCENARIO_COUNT && scenario != sc) continue;
+		for (int so = 0; so < SOLVER_COUNT; so++) {
+			if (solver != SOLVER_COUNT && solver != so) continue;
+			Setup setup = setup_scenario(sc, count);
+			PhaseTimes times = run(&setup, so, steps, pool);
+			print_result(format, first, sc, so, setup.world.size, steps, so == SOLVER_THREADED || so == SOLVER_JACOBI ? threads : 1, times);
+			fflush(stdout);
+			first = 0;
+			free_setup(&setup);
+		}
+	}
+
+	if (strcmp(format, "json") == 0) printf("\n]\n");
+	free_worker_pool(pool);
+	return 0;
+}
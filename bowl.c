@@ -4,7 +4,7 @@
 #include <stdio.h>
 #include <SDL2/SDL.h>
 
-#include "shape.h"
+#include "render.h"
 #include "physics.h"
 
 #define SCREEN_WIDTH 1500
@@ -36,24 +36,22 @@ int main() {
 		return 1;
 	}
 
+	View view = {.screen_width = SCREEN_WIDTH, .screen_height = SCREEN_HEIGHT, .pixels_per_unit = PIXELS_PER_UNIT};
+
 	// Setup physics engine
 	World world = world_with_capacity(1024);
 
-	float dt = 1.0/60;
+	StepSettings settings = {
+		.substeps = 1,
+		.dt = 1.0/60,
+		.gravity = 9.8,
+		.boundary = boundary_circle(0, 0, 10),
+		.collision_iterations = 4,
+	};
 	
 	// Run simulation
 	while (1) {
-		world_update_positions(&world, dt);
-		
-		// Apply constraits
-		for (int steps = 0; steps < 4; steps++) {
-			world_collide(&world);
-		}
-		for (int i = 0; i < world.size; i++) {
-			constrain_distance_from_point(&world, i, 0, 0, 10);
-		}
-		
-		world_apply_gravity(&world, 9.8);
+		world_step(&world, &settings);
 
 		// Check for input
 		SDL_Event event;
@@ -75,18 +73,7 @@ int main() {
 		SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
 		SDL_RenderClear(renderer);
 
-		for (int i = 0; i < world.size; i++) {
-
-			int color = (i * 20 * i % 256);
-
-			SDL_SetRenderDrawColor(renderer, color, 255-color, 255, 255);
-			int x = (-world.objects[i].position.x * PIXELS_PER_UNIT) + (SCREEN_WIDTH/2);
-			int y = (-world.objects[i].position.y * PIXELS_PER_UNIT) + (SCREEN_HEIGHT/2);
-			int r = (world.objects[i].radius * PIXELS_PER_UNIT);
-		
-			draw_circle(renderer, x, y, r);
-			
-		}
+		render_world(renderer, &view, &world);
 
 		SDL_RenderPresent(renderer);
 	}
@@ -4,8 +4,10 @@
 #include <stdio.h>
 #include <SDL2/SDL.h>
 
-#include "shape.h"
+#include "render.h"
 #include "physics.h"
+#include "physics_constraints.h"
+#include "physics_threaded.h"
 
 #define SCREEN_WIDTH 1500
 #define SCREEN_HEIGHT 1200
@@ -15,11 +17,44 @@
 
 #define CLOTH_X	14
 #define CLOTH_Y	14
+#define THREADS 4
 
 int get_cloth_idx(int x, int y) {
 	return y + x * CLOTH_Y;
 } 
 
+// Everything that keeps the cloth together, and the object following the cursor
+typedef struct Cloth {
+	// Colored, so they can be solved by the worker threads
+	DistanceConstraints constraints;
+	WorkerPool* pool;
+	float dt;
+	float control_x;
+	float control_y;
+} Cloth;
+
+// Run once every substep by world_step, before the collision iterations
+void step_begin_cloth(World* w, void* data) {
+	Cloth* cloth = data;
+	distance_constraints_begin_step(&cloth->constraints, cloth->dt);
+}
+
+// Run by world_step after every collision iteration
+void step_constrain_cloth(World* w, void* data) {
+	Cloth* cloth = data;
+
+	// Fix position of top row of cloth
+	for (int x = 0; x < CLOTH_X; x++) {
+		constrain_distance_from_point(w, get_cloth_idx(x, CLOTH_Y-1) , (float)x - (float)CLOTH_X/2, ((float)CLOTH_Y-1)/2, 0);
+	}
+
+	// Constrain cloth to be withing a certan distance of neibors
+	distance_constraints_threaded_solve(w, &cloth->constraints, cloth->pool);
+
+	// Give user control of an object
+	constrain_distance_from_point(w, CLOTH_Y*CLOTH_X , cloth->control_x, cloth->control_y, 0);
+}
+
 /////////////////////////////
 // The main function       //
 /////////////////////////////
@@ -43,6 +78,8 @@ int main() {
 		return 1;
 	}
 
+	View view = {.screen_width = SCREEN_WIDTH, .screen_height = SCREEN_HEIGHT, .pixels_per_unit = PIXELS_PER_UNIT};
+
 	// Setup physics engine
 	World world = world_with_capacity(1 + CLOTH_X * CLOTH_Y);
 
@@ -54,49 +91,41 @@ int main() {
 			world_spawn(&world, wx, wy, OBJECT_RADIUS);
 		}
 	}
-	float dt = 1.0/60;
+
+	// Connect every object to it's neibors
+	Cloth cloth = {.constraints = distance_constraints_with_capacity(2 * CLOTH_X * CLOTH_Y), .pool = new_worker_pool(THREADS), .dt = 1.0/60};
+	for (int x = 0; x < CLOTH_X; x++) {
+		for (int y = 0; y < CLOTH_Y; y++) {
+			if (y < CLOTH_Y - 1)
+				distance_constraints_add(&cloth.constraints, &world, get_cloth_idx(x, y), get_cloth_idx(x, y + 1), 1.1);
+			if (x < CLOTH_X - 1)
+				distance_constraints_add(&cloth.constraints, &world, get_cloth_idx(x, y), get_cloth_idx(x + 1, y), 1.1);
+		}
+	}
+	distance_constraints_color(&cloth.constraints, world.size);
 	
 	// Create object for user to move
 	world_spawn(&world, -10, -10, 1);
 	int mx = 0, my = 0;
+
+	StepSettings settings = {
+		.substeps = 1,
+		.dt = cloth.dt,
+		.gravity = 9.8,
+		// Keep particles withing a circle
+		.boundary = boundary_circle(0, 0, 15),
+		.collision_iterations = 4,
+		.broad_phase = step_begin_cloth,
+		.broad_phase_data = &cloth,
+		.constrain = step_constrain_cloth,
+		.constrain_data = &cloth,
+	};
 	
 	// Run simulation
 	while (1) {
-		world_update_positions(&world, dt);
-		
-		// Object collison 
-		for (int steps = 0; steps < 4; steps++) {
-		
-		world_collide(&world);
-		
-		// Fix position of top row of cloth
-		for (int x = 0; x < CLOTH_X; x++) {
-			constrain_distance_from_point(&world, get_cloth_idx(x, CLOTH_Y-1) , (float)x - (float)CLOTH_X/2, ((float)CLOTH_Y-1)/2, 0);
-		}
-		
-		// Constrain cloth to be withing a certan distance of neibors
-		for (int x = 0; x < CLOTH_X; x++) {
-			for (int y = 0; y < CLOTH_Y; y++) {
-				int idx = x * CLOTH_X + y;
-				if (y < CLOTH_Y - 1)
-					constrain_distance_between_objects(&world, idx, idx + 1, 1.1);
-				if (x < CLOTH_X - 1)
-					constrain_distance_between_objects(&world, idx, idx + CLOTH_X, 1.1);
-			}
-		}
-
-		// Give user control of an object
-		float control_x = -((float)mx - SCREEN_WIDTH/2) / PIXELS_PER_UNIT;
-		float control_y = -((float)my - SCREEN_HEIGHT/2) / PIXELS_PER_UNIT;
-		constrain_distance_from_point(&world, CLOTH_Y*CLOTH_X , control_x, control_y, 0);
-
-		// Keep particles withing a circle
-		for (int i = 0; i < world.size; i++) {
-			constrain_distance_from_point(&world, i, 0, 0, 15);
-		}
-		}
-		
-		world_apply_gravity(&world, 9.8);
+		cloth.control_x = -((float)mx - SCREEN_WIDTH/2) / PIXELS_PER_UNIT;
+		cloth.control_y = -((float)my - SCREEN_HEIGHT/2) / PIXELS_PER_UNIT;
+		world_step(&world, &settings);
 
 		// Check for input
 		SDL_Event event;
@@ -117,22 +146,13 @@ int main() {
 		SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
 		SDL_RenderClear(renderer);
 
-		for (int i = 0; i < world.size; i++) {
-
-			int color = (i * 20 * i % 256);
-
-			SDL_SetRenderDrawColor(renderer, color, 255-color, 255, 255);
-			int x = (-world.objects[i].position.x * PIXELS_PER_UNIT) + (SCREEN_WIDTH/2);
-			int y = (-world.objects[i].position.y * PIXELS_PER_UNIT) + (SCREEN_HEIGHT/2);
-			int r = (world.objects[i].radius * PIXELS_PER_UNIT);
-		
-			draw_circle(renderer, x, y, r);
-			
-		}
+		render_world(renderer, &view, &world);
 
 		SDL_RenderPresent(renderer);
 	}
 	
 
+	distance_constraints_free(&cloth.constraints);
+	free_worker_pool(cloth.pool);
 	world_cleanup(&world);
 }
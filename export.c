@@ -0,0 +1,146 @@
+// Headless video export, runs the stress test without a window and writes every frame to a video file.
+//
+// Usage: export [--output FILE] [--frames N] [--width N] [--height N] [--threads N] [--format y4m|raw] [--outline]
+//
+// y4m (the default) can be played or converted by most video tools, for example: ffmpeg -i out.y4m out.mp4
+// raw is width * height RGBA pixels per frame, with nothing between frames.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "physics_threaded.h"
+#include "raster.h"
+
+#define TIMESTEP (1.0/60/3)
+#define FPS 60
+#define PIXELS_PER_UNIT 25
+#define SPAWN_DELAY 2
+#define SPAWN_Y 19
+#define SPAWN_COUNT 30
+#define SORT_DELAY 60
+
+double now_seconds() {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/////////////////////////////
+// The main function       //
+/////////////////////////////
+
+int main(int argc, char** argv) {
+	const char* output = "out.y4m";
+	int frames = 600;
+	int width = 1500;
+	int height = 1200;
+	int threads = 4;
+	const char* format = "y4m";
+	int outline = 0;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--outline") == 0) {
+			outline = 1;
+			continue;
+		}
+		if (i + 1 >= argc) {
+			fprintf(stderr, "Missing value for %s\n", argv[i]);
+			return 1;
+		}
+		if (strcmp(argv[i], "--output") == 0) {
+			output = argv[++i];
+		} else if (strcmp(argv[i], "--frames") == 0) {
+			frames = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--width") == 0) {
+			width = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--height") == 0) {
+			height = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--threads") == 0) {
+			threads = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--format") == 0) {
+			format = argv[++i];
+		} else {
+			fprintf(stderr, "Unknown option %s\n", argv[i]);
+			return 1;
+		}
+	}
+	int y4m = strcmp(format, "y4m") == 0;
+	if (frames < 1 || width < 1 || height < 1 || (!y4m && strcmp(format, "raw") != 0)) {
+		fprintf(stderr, "Invalid arguments\n");
+		return 1;
+	}
+
+	FILE* file = fopen(output, "wb");
+	if (!file) {
+		fprintf(stderr, "Could not open %s\n", output);
+		return 1;
+	}
+
+	// Setup physics engine, the same as the stress test
+	WorkerPool* pool = new_worker_pool(threads);
+	AccessGrid grid = new_access_grid(42*4, 42*4, -21, -21, 0.25);
+	World world = world_with_capacity(1024);
+	world.sleep_threshold = 0.001;
+	world.sleep_delay = 30;
+	ThreadedCollide collide = {.grid = &grid, .pool = pool};
+	StepSettings settings = {
+		.substeps = 3,
+		.dt = TIMESTEP,
+		.gravity = 9.8,
+		.boundary = boundary_box(-20, 20, -20, 20),
+		.collision_iterations = 2,
+		.broad_phase = step_update_grid,
+		.broad_phase_data = &grid,
+		.collide = step_threaded_grid_collide,
+		.collide_data = &collide,
+	};
+
+	Rasterizer raster = new_rasterizer(width, height, PIXELS_PER_UNIT, pool);
+	raster.filled = !outline;
+	if (y4m) raster_write_y4m_header(file, &raster, FPS);
+
+	double simulation_time = 0, draw_time = 0;
+	for (int frame = 0; frame < frames; frame++) {
+		double start = now_seconds();
+		world_step(&world, &settings);
+		if (frame % SORT_DELAY == 0) world_spatial_sort(&world, &grid);
+		if (frame % SPAWN_DELAY == 0) {
+			float spawn_x[SPAWN_COUNT], spawn_y[SPAWN_COUNT], spawn_r[SPAWN_COUNT];
+			for (int i = 0; i < SPAWN_COUNT; i++) {
+				spawn_x[i] = i - 15;
+				spawn_y[i] = SPAWN_Y;
+				spawn_r[i] = 0.1;
+			}
+			int first = world.size;
+			int count = world_spawn_batch(&world, SPAWN_COUNT, spawn_x, spawn_y, spawn_r);
+			// Give the new objects some velocity
+			for (int i = first; i < first + count; i++) {
+				world.objects[i].position.x -= 0.04;
+				world.objects[i].position.y -= 0.04;
+			}
+		}
+		double middle = now_seconds();
+
+		rasterizer_draw_world(&raster, &world);
+		int written = y4m ? raster_write_y4m_frame(file, &raster) : raster_write_raw(file, &raster);
+		if (!written) {
+			fprintf(stderr, "Writing to %s failed\n", output);
+			return 1;
+		}
+		double end = now_seconds();
+		simulation_time += middle - start;
+		draw_time += end - middle;
+	}
+
+	printf("%d frames, %d objects, %.2f s simulating, %.2f s drawing and writing, %.1fx real time\n",
+		frames, world.size, simulation_time, draw_time, frames / (double)FPS / (simulation_time + draw_time));
+
+	fclose(file);
+	free_rasterizer(&raster);
+	free_access_grid(&grid);
+	world_cleanup(&world);
+	free_worker_pool(pool);
+	return 0;
+}
@@ -2,8 +2,8 @@
 //
 // To use it, first initalize the World struct using the world_with_capacity, add objects using world_spawn
 //
-// To simulate it call world_step every timestep.
-// To add gravity call apply_gravity every timestep and pass the acceleration due to gravity.
+// To simulate it call world_step every timestep, which applies gravity, collisions and keeps objects in a boundary.
+// Or do it by hand: call world_update_positions every timestep, and world_apply_gravity to add gravity.
 // Constraints are applied by calling the constriant function every frame. The most important one is world_collide,
 // which implements a simple non-intersection constraint, assuming every object has equal mass and collisions are
 // inelastic.
@@ -11,15 +11,76 @@
 // There is nothing special about the constraint_* and world_collide functions, you can get the same effect by simple manipulating object's .position property.
 //
 // If constraints are not a rigid as they should be, or collisions start becoming unstable, try running the constraints multiple times per timestep, or/and reducing the timestep.
+//
+// Objects that have stopped moving can be put to sleep, so they are no longer integrated or collided with each other, set .sleep_delay on the world to enable this.
+//
+// Compile with -DPHYSICS_STATS to count what the solvers do and time each part of world_step, see PhysicsStats.
 
 
 #ifndef HAS_PHYSICS
 #define HAS_PHYSICS 1
 
 #include <stdlib.h>
-#include <stdio.h>
 #include <math.h>
-#include <SDL2/SDL.h>
+#include <stdint.h>
+
+////////////////
+// Statistics //
+////////////////
+
+#ifdef PHYSICS_STATS
+#include <time.h>
+
+// Counters for everything the engine does, only there when compiled with -DPHYSICS_STATS.
+// These add up until physics_stats_reset is called, and are safe to update from many threads.
+typedef struct PhysicsStats {
+	// Pairs of objects checked for collisions, and how many of them were intersecting
+	long long pairs_tested;
+	long long contacts_resolved;
+	// Grid cells searched for collisions
+	long long cells_visited;
+	// Objects outside of the grid when it was built, these don't collide
+	long long objects_outside_grid;
+	// Full rebuilds of an AccessGrid, and objects moved between cells by access_grid_update instead
+	long long grid_rebuilds;
+	long long grid_objects_moved;
+	// Rebuilds of a ContactCache
+	long long contact_cache_builds;
+	// Distance constraints found stretched when solving them, and how many broke
+	long long constraint_violations;
+	long long constraints_broken;
+	// Substeps run by world_step, and nanoseconds spent in each part of them
+	long long substeps;
+	long long integrate_ns;
+	long long broad_phase_ns;
+	long long collide_ns;
+	long long constrain_ns;
+} PhysicsStats;
+
+PhysicsStats physics_stats;
+
+void physics_stats_reset() {
+	PhysicsStats zero = {0};
+	physics_stats = zero;
+}
+
+long long physics_stats_now() {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (long long)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+// Add count to a counter in physics_stats
+#define PHYSICS_STAT(field, count) __atomic_fetch_add(&physics_stats.field, (long long)(count), __ATOMIC_RELAXED)
+// Start a timer called name, and add the time since it started to a counter
+#define PHYSICS_TIMER(name) long long name = physics_stats_now()
+#define PHYSICS_TIME(name, field) PHYSICS_STAT(field, physics_stats_now() - name)
+#else
+// Without PHYSICS_STATS these do nothing, the counts are only local variables, which the compiler removes.
+#define PHYSICS_STAT(field, count) ((void)(count))
+#define PHYSICS_TIMER(name) ((void)0)
+#define PHYSICS_TIME(name, field) ((void)0)
+#endif
 
 ///////////////////////////////
 // low level math functions. //
@@ -71,8 +132,32 @@ typedef struct Body {
 	Vector2 position_old;
 	Vector2 position;
 	Vector2 acceleration; 
+
+	// Sleeping objects are not moved by integration, and don't collide with other sleeping objects, see world_update_sleep.
+	// The top bit (BODY_ASLEEP) is set if the object is asleep, the rest (BODY_REST_TICKS) count how many timesteps in a row
+	// it has barely moved. Kept in 16 bits so the body stays small, since every solver reads it.
+	uint16_t sleep;
 } Body;
 
+#define BODY_ASLEEP 0x8000
+#define BODY_REST_TICKS 0x7fff
+
+// Returns non zero if the object is asleep
+int physics_asleep(Body* body) {
+	return body->sleep & BODY_ASLEEP;
+}
+
+// How far an object moved last timestep, squared
+float physics_speed2(Body* body) {
+	Vector2 moved = vector_sub(body->position, body->position_old);
+	return moved.x * moved.x + moved.y * moved.y;
+}
+
+// Wake up a sleeping object, call this after moving an object by hand.
+void physics_wake(Body* body) {
+	body->sleep = 0;
+}
+
 // Use Verlet integration to apply velocity and acceleration to the body.
 // This is the core of the physics simulation, and should be called every timestep.
 void physics_update_position(Body* body, float dt) {
@@ -93,7 +178,8 @@ Body physics_new_with_position(float x, float y, float r) {
 		.radius = r,
 		.position_old = {.x = x,  .y = y},
 		.position = {.x = x,  .y = y},
-		.acceleration = {.x = 0, .y = 0}
+		.acceleration = {.x = 0, .y = 0},
+		.sleep = 0
 	};
 	return b;
 }
@@ -111,33 +197,121 @@ typedef struct World {
 	int size;
 	// The total amount that can be stored at a given time.
 	int capacity;
+	// Every object is given an id when it is inserted, which stays the same if the objects are reordered (see world_spatial_sort in physics_optimized.h)
+	// .ids[index] is the id of the object at index, .indices[id] is the index of the object with that id.
+	// These should point to .capacity ints, or be null if the objects are never reordered or removed, in which case the id is the index.
+	int* ids;
+	int* indices;
+	// The ids of removed objects are reused, .generations[id] counts how many times an id has been removed, so old handles can be detected.
+	// For unused ids .indices[id] is the next unused id, with .free_id being the first one, or -1 if there are none.
+	int* generations;
+	int free_id;
+	// The number of ids given out so far, including unused ones.
+	int id_count;
+	// If set, the arrays are on the heap and are grown when the world is full, set by world_with_capacity.
+	int growable;
+	// Incremented whenever objects change index (removing or sorting them), so anything holding on to indices can tell it is out of date.
+	int reorders;
+
+	// Objects that move less than .sleep_threshold per timestep for .sleep_delay timesteps in a row are put to sleep.
+	// A .sleep_delay of 0 (the default) disables sleeping, it can be at most BODY_REST_TICKS.
+	float sleep_threshold;
+	int sleep_delay;
 } World;
 
 // Allocate a empty world with a capacity to hold up to capacity objects
 // This allocates .objects on the heap, so make sure to call world_cleanup before discarding the World object.
+// The world grows when more objects are added, so capacity is only a starting point.
 World world_with_capacity(int capacity) {
 	World w = {
 		.objects = malloc(capacity * sizeof(Body)),
 		.size = 0,
-		.capacity = capacity
+		.capacity = capacity,
+		.ids = malloc(capacity * sizeof(int)),
+		.indices = malloc(capacity * sizeof(int)),
+		.generations = malloc(capacity * sizeof(int)),
+		.free_id = -1,
+		.id_count = 0,
+		.growable = 1,
+		.reorders = 0,
+		.sleep_threshold = 0,
+		.sleep_delay = 0
 	};
 	return w;
 }
 
+// Make sure the world has space for at least capacity objects, growing it if needed.
+// Returns 1 if sucessfull, 0 if the world is not growable, or allocation failed.
+int world_reserve(World* w, int capacity) {
+	if (capacity <= w->capacity) return 1;
+	if (!w->growable) return 0;
+
+	Body* objects = realloc(w->objects, capacity * sizeof(Body));
+	if (!objects) return 0;
+	w->objects = objects;
+	if (w->ids) {
+		int* ids = realloc(w->ids, capacity * sizeof(int));
+		if (!ids) return 0;
+		w->ids = ids;
+		int* indices = realloc(w->indices, capacity * sizeof(int));
+		if (!indices) return 0;
+		w->indices = indices;
+		int* generations = realloc(w->generations, capacity * sizeof(int));
+		if (!generations) return 0;
+		w->generations = generations;
+	}
+	w->capacity = capacity;
+	return 1;
+}
+
+// Make space for count more objects, at least doubling the capacity so adding objects one at a time stays cheap.
+int world_grow(World* w, int count) {
+	int needed = w->size + count;
+	if (needed <= w->capacity) return 1;
+	int capacity = w->capacity * 2;
+	if (capacity < 16) capacity = 16;
+	if (capacity < needed) capacity = needed;
+	return world_reserve(w, capacity);
+}
+
 // Frees the objects array of a world, call before discarding if it was heap allocated
 void world_cleanup(World* w) {
 	free(w->objects);
+	free(w->ids);
+	free(w->indices);
+	free(w->generations);
 	// Set these to make sure no one tries to access any of the freed datastructures;
 	w->size = 0;
 	w->capacity = 0;
 	w->objects = 0;
+	w->ids = 0;
+	w->indices = 0;
+	w->generations = 0;
+	w->free_id = -1;
+	w->id_count = 0;
+}
+
+// Give the object at idx an id, reusing the id of a removed object if there is one.
+void world_assign_id(World* w, int idx) {
+	if (!w->ids) return;
+	int id;
+	if (w->free_id >= 0) {
+		id = w->free_id;
+		w->free_id = w->indices[id];
+	} else {
+		id = w->id_count++;
+		w->generations[id] = 0;
+	}
+	w->ids[idx] = id;
+	w->indices[id] = idx;
 }
 
-// Add an object to a world, fails if there is no space left in the world.
+// Add an object to a world, growing it if needed. Fails if there is no space left in a world that is not growable.
 // Returns 1 if sucessfull, 0 if not.
 int world_insert_object(World* world, Body object) {
-	if (world->capacity > world->size) {
+	if (world->capacity > world->size || world_grow(world, 1)) {
 		world->objects[world->size] = object;
+		world_assign_id(world, world->size);
 		world->size++;
 		return 1;
 	} else {
@@ -145,12 +319,198 @@ int world_insert_object(World* world, Body object) {
 	}
 }
 
+// Get the current index of an object from it's id, if no objects have been removed, the id is the index the object was inserted at.
+// Use this when holding on to objects in a world that gets reordered.
+int world_body_index(World* w, int id) {
+	if (w->indices) return w->indices[id];
+	return id;
+}
+
+// A reference to an object that stays valid when objects are reordered or removed.
+// Once the object is removed, world_handle_index returns -1, even if the id has been reused.
+typedef struct BodyHandle {
+	int id;
+	int generation;
+} BodyHandle;
+
+// Get a handle for the object at idx.
+// Handles need ids, for a world without them (.ids or .generations is null, like a World made by hand) this returns an invalid handle.
+BodyHandle world_handle(World* w, int idx) {
+	if (!w->ids || !w->generations) {
+		BodyHandle invalid = {.id = -1, .generation = -1};
+		return invalid;
+	}
+	BodyHandle handle = {.id = w->ids[idx], .generation = w->generations[w->ids[idx]]};
+	return handle;
+}
+
+// Get the current index of the object refered to by a handle, or -1 if it has been removed (or the world has no ids).
+int world_handle_index(World* w, BodyHandle handle) {
+	if (!w->ids || !w->generations) return -1;
+	if (handle.id < 0 || handle.id >= w->id_count) return -1;
+	if (w->generations[handle.id] != handle.generation) return -1;
+	return w->indices[handle.id];
+}
+
+// Wake up every sleeping object within distance of touching a circle at position with the given radius.
+// Sleeping objects don't fall, so this has to be done when something they could be resting on goes away.
+void world_wake_near(World* w, Vector2 position, float radius, float distance) {
+	for (int i = 0; i < w->size; i++) {
+		Body* body = &w->objects[i];
+		if (!physics_asleep(body)) continue;
+		float reach = radius + body->radius + distance;
+		Vector2 difference = vector_sub(body->position, position);
+		if (difference.x * difference.x + difference.y * difference.y < reach * reach) physics_wake(body);
+	}
+}
+
+// Remove the object at idx, by moving the last object into it's place, so this changes the index of the last object.
+// The id of the removed object is freed for reuse, and handles to it become invalid.
+// This also works for worlds without ids, but then there is nothing to tell which object moved except World.reorders.
+// If the world has sleeping enabled, sleeping objects touching the removed one are woken up, so they don't float where it was.
+// That looks at every object, so it makes removing slower.
+void world_remove_object(World* w, int idx) {
+	int last = w->size - 1;
+	Body removed = w->objects[idx];
+	if (w->ids && w->indices) {
+		int id = w->ids[idx];
+		if (w->generations) w->generations[id]++;
+		w->indices[id] = w->free_id;
+		w->free_id = id;
+		if (idx != last) {
+			w->ids[idx] = w->ids[last];
+			w->indices[w->ids[idx]] = idx;
+		}
+	}
+	w->objects[idx] = w->objects[last];
+	w->size--;
+	w->reorders++;
+	// Anything within half a radius counts as touching, objects resting on each other aren't exactly one radius apart
+	if (w->sleep_delay > 0) world_wake_near(w, removed.position, removed.radius, removed.radius * 0.5);
+}
+
+// Remove the object refered to by a handle, returns 1 if sucessfull, 0 if the object was already removed.
+int world_remove(World* w, BodyHandle handle) {
+	int idx = world_handle_index(w, handle);
+	if (idx < 0) return 0;
+	world_remove_object(w, idx);
+	return 1;
+}
+
+// Remove every object with it's center outside of a bounding box, returns how many were removed.
+// Like world_remove_object, this changes the indices of the remaining objects.
+int world_remove_outside(World* w, float minx, float maxx, float miny, float maxy) {
+	int removed = 0;
+	int i = 0;
+	while (i < w->size) {
+		Vector2 p = w->objects[i].position;
+		if (p.x < minx || p.x > maxx || p.y < miny || p.y > maxy) {
+			// The last object is moved into i, so check i again
+			world_remove_object(w, i);
+			removed++;
+		} else {
+			i++;
+		}
+	}
+	return removed;
+}
 
 // Run Verlet integration for the whole world, call this every timestep
 void world_update_positions(World* w, float dt) {
 	for (int i = 0; i < w->size; i++) {
-		physics_update_position(&w->objects[i], dt);
+		Body* body = &w->objects[i];
+		if (physics_asleep(body)) {
+			// Forces don't build up while sleeping
+			body->acceleration.x = 0;
+			body->acceleration.y = 0;
+			continue;
+		}
+		physics_update_position(body, dt);
+	}
+}
+
+// Put objects that have been still for long enough to sleep, call this at the end of every timestep if .sleep_delay is set.
+// How far an object moved is it's Verlet velocity (position - position_old), so this has to run after the constraints.
+void world_update_sleep(World* w) {
+	if (w->sleep_delay <= 0) return;
+	float threshold2 = w->sleep_threshold * w->sleep_threshold;
+	for (int i = 0; i < w->size; i++) {
+		Body* body = &w->objects[i];
+		if (physics_asleep(body)) continue;
+		if (physics_speed2(body) < threshold2) {
+			int rest_ticks = body->sleep & BODY_REST_TICKS;
+			if (rest_ticks < BODY_REST_TICKS) rest_ticks++;
+			if (rest_ticks >= w->sleep_delay) {
+				body->sleep = BODY_ASLEEP;
+				// Remove what is left of the velocity, so it doesn't come back when waking up
+				body->position_old = body->position;
+			} else {
+				body->sleep = rest_ticks;
+			}
+		} else {
+			body->sleep = 0;
+		}
+	}
+}
+
+// Wake up the object at idx
+void world_wake(World* w, int idx) {
+	physics_wake(&w->objects[idx]);
+}
+
+// Wake up every object, for example after changing gravity
+void world_wake_all(World* w) {
+	for (int i = 0; i < w->size; i++) physics_wake(&w->objects[i]);
+}
+
+// Wake up the object at idx if a constraint moved it further than .sleep_threshold.
+// Smaller corrections happen every timestep to objects at rest (like a pinned object pulled back after falling a bit), so they don't count.
+void world_wake_moved(World* w, int idx, float distance) {
+	if (distance > w->sleep_threshold) physics_wake(&w->objects[idx]);
+}
+
+// A sleeping object is woken up when hit by an object moving more than this many times .sleep_threshold per timestep.
+// Objects in a pile jitter a bit, so waking on any movement wakes the whole pile back up.
+#define SLEEP_WAKE_FACTOR 8
+
+// Push two objects apart if they intersect, this is the collision response used by all the collision solvers.
+// Returns 1 if they were intersecting, so solvers can count contacts.
+// Sleeping objects don't collide with each other. If only one of them is asleep, it is woken up if the other one is moving fast
+// (see SLEEP_WAKE_FACTOR), otherwise the sleeping one is treated as fixed in place, so objects settling on a sleeping pile don't wake it up.
+int world_collide_pair(World* w, int idx1, int idx2) {
+	Body* body1 = &w->objects[idx1];
+	Body* body2 = &w->objects[idx2];
+	if (physics_asleep(body1) && physics_asleep(body2)) return 0;
+
+	float mindistance = body1->radius + body2->radius;
+	Vector2 difference = vector_sub(body1->position, body2->position);
+	float distance = vector_length(difference);
+
+	// Check for intersections
+	if (mindistance > distance) {
+		// How much of the overlap each object is moved by
+		float share1 = 0.5, share2 = 0.5;
+		if (physics_asleep(body1) || physics_asleep(body2)) {
+			float wake = w->sleep_threshold * SLEEP_WAKE_FACTOR;
+			Body* sleeping = physics_asleep(body1) ? body1 : body2;
+			Body* moving = physics_asleep(body1) ? body2 : body1;
+			if (physics_speed2(moving) > wake * wake) {
+				physics_wake(sleeping);
+			} else {
+				share1 = physics_asleep(body1) ? 0 : 1;
+				share2 = 1 - share1;
+			}
+		}
+
+		float delta = mindistance - distance;
+		// Objects exactly on top of each other (for example both pushed into the corner of a boundary) have no direction between them, so pick one.
+		Vector2 direction = {.x = 1, .y = 0};
+		if (distance > 0) direction = vector_mul_scaler(difference, 1.0/distance);
+		body1->position = vector_add(body1->position, vector_mul_scaler(direction, delta * share1));
+		body2->position = vector_sub(body2->position, vector_mul_scaler(direction, delta * share2));
+		return 1;
 	}
+	return 0;
 }
 
 // Apply a downwards acceleration to all objects in a world, this sould also be called every timestep if you want gravity to be applied.
@@ -165,27 +525,15 @@ void world_apply_gravity(World* w, float g) {
 void world_collide(World* w) {
 	// This is fairly simple, it just finds all intersecting objects and moves them until they no longer intesect.
 	// It is however, rather slow, O(n^2), this should be optimized at some point.
+	int contacts = 0;
 	for (int i = 0; i < w->size; i++) {
 		// This iterates up to i and not w->size to avoid rendundent checks and checking an object against itself
 		for (int e = 0; e < i; e++) {
-			float mindistance = w->objects[i].radius + w->objects[e].radius;
-			
-			Vector2* object1 = &w->objects[i].position;
-			Vector2* object2 = &w->objects[e].position;
-			Vector2 difference = vector_sub(*object1, *object2);
-			
-			float distance = vector_length(difference);
-			
-			// Check for intersections
-			if (mindistance > distance) {
-				float delta = (mindistance - distance) / 2;
-				Vector2 adjustment = vector_mul_scaler(vector_mul_scaler(difference, 1.0/distance), delta);
-				*object1 = vector_add(*object1, adjustment);
-				*object2 = vector_sub(*object2, adjustment);
-			
-			}
+			contacts += world_collide_pair(w, i, e);
 		}
 	}
+	PHYSICS_STAT(pairs_tested, (long long)w->size * (w->size - 1) / 2);
+	PHYSICS_STAT(contacts_resolved, contacts);
 }
 
 // Create an object with given position and radius in the world, returns 1 if sucessful, 0 if object max is exeded.
@@ -195,6 +543,27 @@ int world_spawn(World* w, float x, float y, float r) {
 	return world_insert_object(w, object);
 }
 
+// Create count objects in one go, at the positions in x and y, with the radii in r. Each array should have count entries.
+// This only grows the world once, and returns the number of objects created, which is less than count if the world ran out of space.
+int world_spawn_batch(World* w, int count, const float* x, const float* y, const float* r) {
+	world_grow(w, count);
+	if (count > w->capacity - w->size) count = w->capacity - w->size;
+
+	for (int i = 0; i < count; i++) {
+		int idx = w->size + i;
+		Body* b = &w->objects[idx];
+		b->radius = r[i];
+		b->position.x = b->position_old.x = x[i];
+		b->position.y = b->position_old.y = y[i];
+		b->acceleration.x = 0;
+		b->acceleration.y = 0;
+		b->sleep = 0;
+		world_assign_id(w, idx);
+	}
+	w->size += count;
+	return count;
+}
+
 ///////////////////////////////////////////////////////////
 // Constriants, these should be called once every frame  //
 // There is no magic here, you can implement your own by //
@@ -204,12 +573,14 @@ int world_spawn(World* w, float x, float y, float r) {
 
 
 // Keep an object('s center) within a radius of a point.
+// Like all the constraints here, this wakes the object up if it has to move it, see world_wake_moved.
 void constrain_distance_from_point(World* w, int objectidx, float x, float y, float maxd) {
 	Vector2* object = &w->objects[objectidx].position;
 	Vector2 origin = {.x = x, .y = y};
 	
 	// Edge case handling
 	if (maxd == 0) {
+		world_wake_moved(w, objectidx, vector_length(vector_sub(*object, origin)));
 		*object = origin;
 		return;
 	}
@@ -218,6 +589,7 @@ void constrain_distance_from_point(World* w, int objectidx, float x, float y, fl
 	if (vector_length(difference) > maxd) {
 		float correction = (vector_length(difference)-maxd)/maxd;
 		*object	= vector_sub(*object, vector_mul_scaler(difference, correction));
+		world_wake_moved(w, objectidx, vector_length(difference) - maxd);
 	}
 }
 
@@ -235,16 +607,128 @@ void constrain_distance_between_objects(World* w, int idx1, int idx2, float maxd
 		Vector2 adjustment = vector_mul_scaler(vector_mul_scaler(difference, 1.0/distance), delta);
 		*object1 = vector_sub(*object1, adjustment);
 		*object2 = vector_add(*object2, adjustment);
+		world_wake_moved(w, idx1, delta);
+		world_wake_moved(w, idx2, delta);
 	}
 }
 
 // Keep object('s center) withing a bounding box
 void constrain_bounding_box(World* w, int idx, float minx, float maxx, float miny, float maxy) {
 	Vector2* object = &w->objects[idx].position;
+	Vector2 before = *object;
 	if (object->x > maxx) object->x = maxx;
 	if (object->y > maxy) object->y = maxy;
 	if (object->x < minx) object->x = minx;
 	if (object->y < miny) object->y = miny;
+	if (object->x != before.x || object->y != before.y) world_wake_moved(w, idx, vector_length(vector_sub(*object, before)));
+}
+
+//////////////////////////////////////////////////////////////
+// Stepping, this combines all of the above into a single   //
+// call, touching each object as few times as possible.     //
+//////////////////////////////////////////////////////////////
+
+typedef enum BoundaryType {
+	BOUNDARY_NONE,
+	// Keep objects within a box, like constrain_bounding_box
+	BOUNDARY_BOX,
+	// Keep objects within a radius of a point, like constrain_distance_from_point
+	BOUNDARY_CIRCLE
+} BoundaryType;
+
+// The area world_step keeps objects inside of.
+typedef struct Boundary {
+	BoundaryType type;
+	float minx, maxx, miny, maxy;
+	float x, y, radius;
+} Boundary;
+
+Boundary boundary_box(float minx, float maxx, float miny, float maxy) {
+	Boundary b = {.type = BOUNDARY_BOX, .minx = minx, .maxx = maxx, .miny = miny, .maxy = maxy};
+	return b;
+}
+
+Boundary boundary_circle(float x, float y, float radius) {
+	Boundary b = {.type = BOUNDARY_CIRCLE, .x = x, .y = y, .radius = radius};
+	return b;
+}
+
+// Apply a boundary to a single object
+void constrain_boundary(World* w, int idx, Boundary* b) {
+	if (b->type == BOUNDARY_BOX) constrain_bounding_box(w, idx, b->minx, b->maxx, b->miny, b->maxy);
+	if (b->type == BOUNDARY_CIRCLE) constrain_distance_from_point(w, idx, b->x, b->y, b->radius);
+}
+
+// A collision solver or other constraint for world_step, data is passed through from the StepSettings.
+typedef void (*StepFunction)(World* w, void* data);
+
+// Everything world_step needs to know, only the fields you need have to be set.
+typedef struct StepSettings {
+	// How many times to step the world per call to world_step
+	int substeps;
+	// The timestep of each substep
+	float dt;
+	// Downwards acceleration, like world_apply_gravity
+	float gravity;
+	Boundary boundary;
+	// How many times to run collisions (and .constrain) every substep, more makes collisions more rigid.
+	int collision_iterations;
+	// Optional, run once every substep before the collision iterations, to build datastructures they can share (like a grid),
+	// or to reset anything kept for one substep (like distance_constraints_begin_step).
+	StepFunction broad_phase;
+	void* broad_phase_data;
+	// The collision solver to use, world_collide if null. physics_optimized.h has solvers for this.
+	StepFunction collide;
+	void* collide_data;
+	// Optional, run after every collision iteration, to apply other constraints.
+	StepFunction constrain;
+	void* constrain_data;
+} StepSettings;
+
+// Step the world forward by settings->substeps timesteps.
+// This does the same thing as calling world_update_positions, world_apply_gravity, the collision solver and a
+// constraint on every object each substep, but with gravity, integration and the boundary done in a single pass.
+// The boundary is applied right after integration, which is where objects usually cross it, and once more at the end.
+// If the world has sleeping enabled, world_update_sleep is run after every substep.
+void world_step(World* w, StepSettings* settings) {
+	for (int step = 0; step < settings->substeps; step++) {
+		PHYSICS_TIMER(integrate_start);
+		for (int i = 0; i < w->size; i++) {
+			Body* body = &w->objects[i];
+			if (physics_asleep(body)) {
+				body->acceleration.x = 0;
+				body->acceleration.y = 0;
+				continue;
+			}
+			body->acceleration.y -= settings->gravity;
+			physics_update_position(body, settings->dt);
+			constrain_boundary(w, i, &settings->boundary);
+		}
+		PHYSICS_TIME(integrate_start, integrate_ns);
+
+		PHYSICS_TIMER(broad_phase_start);
+		if (settings->broad_phase) settings->broad_phase(w, settings->broad_phase_data);
+		PHYSICS_TIME(broad_phase_start, broad_phase_ns);
+		for (int iteration = 0; iteration < settings->collision_iterations; iteration++) {
+			PHYSICS_TIMER(collide_start);
+			if (settings->collide) {
+				settings->collide(w, settings->collide_data);
+			} else {
+				world_collide(w);
+			}
+			PHYSICS_TIME(collide_start, collide_ns);
+			PHYSICS_TIMER(constrain_start);
+			if (settings->constrain) settings->constrain(w, settings->constrain_data);
+			PHYSICS_TIME(constrain_start, constrain_ns);
+		}
+		world_update_sleep(w);
+		PHYSICS_STAT(substeps, 1);
+	}
+
+	// Collisions can push objects out of the boundary
+	if (settings->boundary.type != BOUNDARY_NONE) {
+		for (int i = 0; i < w->size; i++) constrain_boundary(w, i, &settings->boundary);
+	}
 }
 
 #endif
@@ -0,0 +1,237 @@
+// Stepping many small, independent worlds at once, for example to try out many diffrent parameters.
+//
+// All the worlds share one SoaWorld (see physics_soa.h), each one using a range of it's arrays, so there is a
+// single allocation for everything, and stepping them doesn't involve any per world setup. The worlds are
+// spread over the threads of a WorkerPool, since they don't interact, no locking is needed.
+//
+// Create a batch with new_world_batch, add worlds with world_batch_add_world, objects with world_batch_spawn and
+// call world_batch_step every timestep. Object i of world w is at index world_batch_body(batch, w, i) in batch->bodies.
+//
+// Has to be compiled with -lpthread under gcc.
+
+#ifndef HAS_PHYSICS_BATCH
+#define HAS_PHYSICS_BATCH 1
+
+#include <stdlib.h>
+#include "physics_soa.h"
+#include "physics_threaded.h"
+
+// How many worlds each thread is given at once, more spreads the work more evenly, but adds overhead.
+#define WORLDS_PER_TASK 4
+
+// One of the worlds in a batch
+typedef struct BatchWorld {
+	// The range of batch->bodies used by this world, start is a multiple of SOA_LANES.
+	int start;
+	int size;
+	int capacity;
+
+	float gravity;
+	Boundary boundary;
+	// The largest radius in this world, used to find collisions.
+	float max_radius;
+} BatchWorld;
+
+typedef struct WorldBatch {
+	// The objects of all the worlds
+	SoaWorld bodies;
+	// The objects of each world, sorted by x position, used to find collisions. Indices are into bodies.
+	// This is kept between steps, since objects don't move much, sorting it again is fast.
+	int* order;
+
+	BatchWorld* worlds;
+	int world_count;
+	int world_capacity;
+} WorldBatch;
+
+// Allocate a batch with space for a total of capacity objects in up to world_capacity worlds.
+// Call free_world_batch before discarding it.
+WorldBatch new_world_batch(int capacity, int world_capacity) {
+	WorldBatch batch = {
+		.bodies = soa_world_with_capacity(capacity),
+		.order = malloc(capacity * sizeof(int)),
+		.worlds = malloc(world_capacity * sizeof(BatchWorld)),
+		.world_count = 0,
+		.world_capacity = world_capacity
+	};
+	return batch;
+}
+
+void free_world_batch(WorldBatch* batch) {
+	soa_world_cleanup(&batch->bodies);
+	free(batch->order);
+	free(batch->worlds);
+	batch->order = 0;
+	batch->worlds = 0;
+	batch->world_count = 0;
+	batch->world_capacity = 0;
+}
+
+// Add a world with space for capacity objects, returns the number of the world, or -1 if the batch is full.
+int world_batch_add_world(WorldBatch* batch, int capacity, float gravity, Boundary boundary) {
+	if (batch->world_count >= batch->world_capacity) return -1;
+
+	// Keep every world aligned, so integration can use the vector loop for all of them
+	int start = batch->bodies.size;
+	int padded = (capacity + SOA_LANES - 1) / SOA_LANES * SOA_LANES;
+	if (start + padded > batch->bodies.capacity) return -1;
+	batch->bodies.size += padded;
+
+	BatchWorld world = {
+		.start = start,
+		.size = 0,
+		.capacity = padded,
+		.gravity = gravity,
+		.boundary = boundary,
+		.max_radius = 0
+	};
+	batch->worlds[batch->world_count] = world;
+	return batch->world_count++;
+}
+
+// Get the index in batch->bodies of object i in a world
+int world_batch_body(WorldBatch* batch, int world, int i) {
+	return batch->worlds[world].start + i;
+}
+
+// Create an object in a world, returns 1 if sucessful, 0 if the world is full.
+int world_batch_spawn(WorldBatch* batch, int world, float x, float y, float r) {
+	BatchWorld* bw = &batch->worlds[world];
+	if (bw->size >= bw->capacity) return 0;
+
+	SoaWorld* b = &batch->bodies;
+	int i = bw->start + bw->size;
+	b->x[i] = b->old_x[i] = x;
+	b->y[i] = b->old_y[i] = y;
+	b->acc_x[i] = b->acc_y[i] = 0;
+	b->radius[i] = r;
+	if (r > bw->max_radius) bw->max_radius = r;
+
+	// New objects go at the end of the order, the next sort moves them into place.
+	batch->order[i] = i;
+	bw->size++;
+	return 1;
+}
+
+// Keep the objects of a world inside of it's boundary, works the same as constrain_boundary.
+void batch_world_constrain(SoaWorld* b, BatchWorld* bw) {
+	Boundary* boundary = &bw->boundary;
+	int end = bw->start + bw->size;
+	if (boundary->type == BOUNDARY_BOX) {
+		for (int i = bw->start; i < end; i++) {
+			if (b->x[i] > boundary->maxx) b->x[i] = boundary->maxx;
+			if (b->y[i] > boundary->maxy) b->y[i] = boundary->maxy;
+			if (b->x[i] < boundary->minx) b->x[i] = boundary->minx;
+			if (b->y[i] < boundary->miny) b->y[i] = boundary->miny;
+		}
+	}
+	if (boundary->type == BOUNDARY_CIRCLE) {
+		for (int i = bw->start; i < end; i++) {
+			float dx = b->x[i] - boundary->x;
+			float dy = b->y[i] - boundary->y;
+			if (boundary->radius == 0) {
+				b->x[i] = boundary->x;
+				b->y[i] = boundary->y;
+				continue;
+			}
+			float distance = sqrtf(dx * dx + dy * dy);
+			if (distance > boundary->radius) {
+				float correction = (distance - boundary->radius) / boundary->radius;
+				b->x[i] -= dx * correction;
+				b->y[i] -= dy * correction;
+			}
+		}
+	}
+}
+
+// Collisions for a single world, using sort and sweep.
+// The objects are sorted by x, then each object is only checked against the following objects that are close enough in x to touch it.
+void batch_world_collide(SoaWorld* b, int* order, BatchWorld* bw) {
+	int* o = order + bw->start;
+	int n = bw->size;
+
+	// Insertion sort, which is close to linear time since the order from the last step is almost right.
+	for (int i = 1; i < n; i++) {
+		int idx = o[i];
+		float x = b->x[idx];
+		int e = i - 1;
+		while (e >= 0 && b->x[o[e]] > x) {
+			o[e + 1] = o[e];
+			e--;
+		}
+		o[e + 1] = idx;
+	}
+
+	int pairs = 0;
+	int contacts = 0;
+	for (int i = 0; i < n; i++) {
+		int idx1 = o[i];
+		float reach = b->radius[idx1] + bw->max_radius;
+		for (int e = i + 1; e < n; e++) {
+			int idx2 = o[e];
+			float dx = b->x[idx1] - b->x[idx2];
+			if (-dx >= reach) break;
+			pairs++;
+			float dy = b->y[idx1] - b->y[idx2];
+			float mindistance = b->radius[idx1] + b->radius[idx2];
+			float distance = sqrtf(dx * dx + dy * dy);
+			if (mindistance > distance) {
+				contacts++;
+				float delta = (mindistance - distance) / 2;
+				// Pick a direction for objects exactly on top of each other, like physics_pair_check
+				float nx = 1, ny = 0;
+				if (distance > 0) {
+					nx = dx / distance;
+					ny = dy / distance;
+				}
+				b->x[idx1] += nx * delta;
+				b->y[idx1] += ny * delta;
+				b->x[idx2] -= nx * delta;
+				b->y[idx2] -= ny * delta;
+			}
+		}
+	}
+	PHYSICS_STAT(pairs_tested, pairs);
+	PHYSICS_STAT(contacts_resolved, contacts);
+}
+
+typedef struct BatchStepJob {
+	WorldBatch* batch;
+	float dt;
+	int substeps;
+	int iterations;
+} BatchStepJob;
+
+void batch_step_task(void* data, int task) {
+	BatchStepJob* job = data;
+	WorldBatch* batch = job->batch;
+	int first = task * WORLDS_PER_TASK;
+	int last = first + WORLDS_PER_TASK;
+	if (last > batch->world_count) last = batch->world_count;
+
+	for (int w = first; w < last; w++) {
+		BatchWorld* bw = &batch->worlds[w];
+		for (int step = 0; step < job->substeps; step++) {
+			soa_world_integrate_range(&batch->bodies, bw->start, bw->start + bw->size, job->dt, bw->gravity);
+			batch_world_constrain(&batch->bodies, bw);
+			for (int iteration = 0; iteration < job->iterations; iteration++) {
+				batch_world_collide(&batch->bodies, batch->order, bw);
+			}
+		}
+		batch_world_constrain(&batch->bodies, bw);
+	}
+}
+
+// Step every world in the batch, this does the same thing as world_step does for a single world, with iterations collision iterations per substep.
+// The worlds are split between the threads of pool, which can be null to do everything on the calling thread.
+void world_batch_step(WorldBatch* batch, float dt, int substeps, int iterations, WorkerPool* pool) {
+	BatchStepJob job = {.batch = batch, .dt = dt, .substeps = substeps, .iterations = iterations};
+	int tasks = (batch->world_count + WORLDS_PER_TASK - 1) / WORLDS_PER_TASK;
+	if (pool) {
+		worker_pool_run(pool, batch_step_task, &job, tasks);
+	} else {
+		for (int task = 0; task < tasks; task++) batch_step_task(&job, task);
+	}
+}
+
+#endif
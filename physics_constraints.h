@@ -0,0 +1,301 @@
+// A store for large numbers of distance constraints, like the ones used for rope and cloth.
+//
+// Add constraints with distance_constraints_add, call distance_constraints_begin_step once every timestep,
+// then distance_constraints_solve every time constraints should be applied.
+// To solve them on many threads, call distance_constraints_color once they are all added.
+// Coloring sorts the constraints into groups (colors) where no two constraints in a group share an object,
+// so every constraint in a group can be solved at the same time, see distance_constraints_threaded_solve in physics_threaded.h.
+//
+// Constraints refer to objects by index, so solving them doesn't have to look anything up, but they also keep a handle to each object.
+// If the world was reordered (world_spatial_sort or removing objects) the indices are updated from the handles before solving,
+// constraints on removed objects are broken. This needs the world to have ids, like worlds from world_with_capacity.
+
+#ifndef HAS_PHYSICS_CONSTRAINTS
+#define HAS_PHYSICS_CONSTRAINTS 1
+
+#include <stdlib.h>
+#include <stdint.h>
+#include "physics.h"
+
+// Constraints keeping pairs of objects within a distance of each other, like constrain_distance_between_objects.
+// Every property is stored in it's own array, constraint i is idx1[i], idx2[i], length[i] and so on.
+typedef struct DistanceConstraints {
+	int* idx1;
+	int* idx2;
+	// Handles to the same objects as idx1 and idx2, to find them again when the world is reordered.
+	BodyHandle* body1;
+	BodyHandle* body2;
+	// The maximum distance between the objects
+	float* length;
+	// How soft the constraint is, the inverse of stiffness. 0 is fully rigid.
+	// This is XPBD compliance, so the constraint is equally soft no matter the timestep or how often it is solved.
+	float* compliance;
+	// The total correction applied this timestep (the lagrange multiplier), reset by distance_constraints_begin_step.
+	float* lambda;
+	// Broken constraints are skipped, set when a constraint has to move an object by more than .break_distance
+	char* broken;
+	int size;
+	int capacity;
+
+	// If more than 0, constraints break when solving them would move an object further than this.
+	float break_distance;
+	// 1 / dt^2 for the current timestep, set by distance_constraints_begin_step.
+	float inverse_dt2;
+	// World.reorders when .idx1 and .idx2 were last updated
+	int world_reorders;
+
+	// After coloring, constraints of color c are color_start[c] up to color_start[c + 1].
+	// This has color_count + 1 entries, and is null before coloring.
+	int* color_start;
+	int color_count;
+} DistanceConstraints;
+
+// Allocate an empty store with space for capacity constraints, it grows if more are added.
+// Call distance_constraints_free before discarding it.
+DistanceConstraints distance_constraints_with_capacity(int capacity) {
+	if (capacity < 1) capacity = 1;
+	DistanceConstraints c = {
+		.idx1 = malloc(capacity * sizeof(int)),
+		.idx2 = malloc(capacity * sizeof(int)),
+		.body1 = malloc(capacity * sizeof(BodyHandle)),
+		.body2 = malloc(capacity * sizeof(BodyHandle)),
+		.length = malloc(capacity * sizeof(float)),
+		.compliance = malloc(capacity * sizeof(float)),
+		.lambda = malloc(capacity * sizeof(float)),
+		.broken = malloc(capacity * sizeof(char)),
+		.size = 0,
+		.capacity = capacity,
+		.break_distance = 0,
+		.inverse_dt2 = 0,
+		.world_reorders = 0,
+		.color_start = 0,
+		.color_count = 0
+	};
+	return c;
+}
+
+void distance_constraints_free(DistanceConstraints* c) {
+	free(c->idx1);
+	free(c->idx2);
+	free(c->body1);
+	free(c->body2);
+	free(c->length);
+	free(c->compliance);
+	free(c->lambda);
+	free(c->broken);
+	free(c->color_start);
+	c->idx1 = 0;
+	c->idx2 = 0;
+	c->body1 = 0;
+	c->body2 = 0;
+	c->length = 0;
+	c->compliance = 0;
+	c->lambda = 0;
+	c->broken = 0;
+	c->color_start = 0;
+	c->size = 0;
+	c->capacity = 0;
+	c->color_count = 0;
+}
+
+// Update the indices of the constraints if the world has been reordered since they were last used.
+// Constraints on objects that have been removed are broken. This is done by distance_constraints_solve, so it is only
+// needed before calling distance_constraints_solve_range directly.
+void distance_constraints_sync(World* w, DistanceConstraints* c) {
+	if (c->world_reorders == w->reorders) return;
+	for (int i = 0; i < c->size; i++) {
+		int idx1 = world_handle_index(w, c->body1[i]);
+		int idx2 = world_handle_index(w, c->body2[i]);
+		if (idx1 < 0 || idx2 < 0) {
+			// Keep the indices in range, so coloring still works, broken constraints are never solved
+			c->broken[i] = 1;
+			idx1 = idx2 = 0;
+		}
+		c->idx1[i] = idx1;
+		c->idx2[i] = idx2;
+	}
+	c->world_reorders = w->reorders;
+}
+
+// Add a rigid constraint keeping objects idx1 and idx2 of w at most length apart, returns the index of the constraint.
+// Set .compliance[index] afterwards to make it softer.
+// This removes the coloring, call distance_constraints_color again after adding constraints.
+int distance_constraints_add(DistanceConstraints* c, World* w, int idx1, int idx2, float length) {
+	// Make sure the existing constraints use the same indices as the new one
+	distance_constraints_sync(w, c);
+	if (c->size >= c->capacity) {
+		c->capacity *= 2;
+		c->idx1 = realloc(c->idx1, c->capacity * sizeof(int));
+		c->idx2 = realloc(c->idx2, c->capacity * sizeof(int));
+		c->body1 = realloc(c->body1, c->capacity * sizeof(BodyHandle));
+		c->body2 = realloc(c->body2, c->capacity * sizeof(BodyHandle));
+		c->length = realloc(c->length, c->capacity * sizeof(float));
+		c->compliance = realloc(c->compliance, c->capacity * sizeof(float));
+		c->lambda = realloc(c->lambda, c->capacity * sizeof(float));
+		c->broken = realloc(c->broken, c->capacity * sizeof(char));
+	}
+	int i = c->size++;
+	c->idx1[i] = idx1;
+	c->idx2[i] = idx2;
+	c->body1[i] = world_handle(w, idx1);
+	c->body2[i] = world_handle(w, idx2);
+	c->length[i] = length;
+	c->compliance[i] = 0;
+	c->lambda[i] = 0;
+	c->broken[i] = 0;
+
+	free(c->color_start);
+	c->color_start = 0;
+	c->color_count = 0;
+	return i;
+}
+
+// Sort the constraints into colors, so no two constraints of the same color share an object.
+// body_count should be more than the highest object index used by any constraint, usually the size of the world.
+//
+// This uses greedy coloring, giving every constraint the first color not used by any other constraint on it's objects.
+// Colors are tracked as a bitmask per object, 64 at a time, which is far more than meshes like cloth need.
+void distance_constraints_color(DistanceConstraints* c, int body_count) {
+	int* color = malloc(c->size * sizeof(int));
+	uint64_t* used = malloc(body_count * sizeof(uint64_t));
+	for (int i = 0; i < c->size; i++) color[i] = -1;
+
+	int color_count = 0;
+	int remaining = c->size;
+	for (int base = 0; remaining > 0; base += 64) {
+		for (int b = 0; b < body_count; b++) used[b] = 0;
+		for (int i = 0; i < c->size; i++) {
+			if (color[i] >= 0) continue;
+			uint64_t taken = used[c->idx1[i]] | used[c->idx2[i]];
+			if (taken == UINT64_MAX) continue;
+			int bit = 0;
+			while (taken & ((uint64_t)1 << bit)) bit++;
+			used[c->idx1[i]] |= (uint64_t)1 << bit;
+			used[c->idx2[i]] |= (uint64_t)1 << bit;
+			color[i] = base + bit;
+			if (color[i] + 1 > color_count) color_count = color[i] + 1;
+			remaining--;
+		}
+	}
+
+	// Counting sort by color
+	free(c->color_start);
+	c->color_start = calloc(color_count + 1, sizeof(int));
+	c->color_count = color_count;
+	for (int i = 0; i < c->size; i++) c->color_start[color[i] + 1]++;
+	for (int k = 0; k < color_count; k++) c->color_start[k + 1] += c->color_start[k];
+
+	int* idx1 = malloc(c->capacity * sizeof(int));
+	int* idx2 = malloc(c->capacity * sizeof(int));
+	BodyHandle* body1 = malloc(c->capacity * sizeof(BodyHandle));
+	BodyHandle* body2 = malloc(c->capacity * sizeof(BodyHandle));
+	float* length = malloc(c->capacity * sizeof(float));
+	float* compliance = malloc(c->capacity * sizeof(float));
+	float* lambda = malloc(c->capacity * sizeof(float));
+	char* broken = malloc(c->capacity * sizeof(char));
+	int* next = malloc((color_count + 1) * sizeof(int));
+	for (int k = 0; k <= color_count; k++) next[k] = c->color_start[k];
+	for (int i = 0; i < c->size; i++) {
+		int position = next[color[i]]++;
+		idx1[position] = c->idx1[i];
+		idx2[position] = c->idx2[i];
+		body1[position] = c->body1[i];
+		body2[position] = c->body2[i];
+		length[position] = c->length[i];
+		compliance[position] = c->compliance[i];
+		lambda[position] = c->lambda[i];
+		broken[position] = c->broken[i];
+	}
+	free(c->idx1);
+	free(c->idx2);
+	free(c->body1);
+	free(c->body2);
+	free(c->length);
+	free(c->compliance);
+	free(c->lambda);
+	free(c->broken);
+	c->idx1 = idx1;
+	c->idx2 = idx2;
+	c->body1 = body1;
+	c->body2 = body2;
+	c->length = length;
+	c->compliance = compliance;
+	c->lambda = lambda;
+	c->broken = broken;
+
+	free(next);
+	free(color);
+	free(used);
+}
+
+// Start a new timestep of length dt, call this once before solving the constraints in each timestep (or substep).
+void distance_constraints_begin_step(DistanceConstraints* c, float dt) {
+	c->inverse_dt2 = 1 / (dt * dt);
+	for (int i = 0; i < c->size; i++) c->lambda[i] = 0;
+}
+
+// Solve constraints start up to end, in order. Call distance_constraints_sync first if the world could have been reordered.
+// If all of them are the same color, none of them share objects, so the order doesn't matter and the range can be split between threads.
+//
+// This is XPBD: the compliance is scaled by 1/dt^2, and the correction already applied this timestep (lambda) is
+// taken into account, so solving a soft constraint more often doesn't make it stiffer. With 0 compliance this
+// is the same as moving each object by half the error.
+//
+// Sleeping objects are handled like world_collide_pair does: constraints between two sleeping objects are skipped,
+// and a sleeping object is only woken up if the other object is moving fast, otherwise it is treated as fixed in place.
+void distance_constraints_solve_range(World* w, DistanceConstraints* c, int start, int end) {
+	Body* objects = w->objects;
+	float break_distance = c->break_distance;
+	float inverse_dt2 = c->inverse_dt2;
+	float wake = w->sleep_threshold * SLEEP_WAKE_FACTOR;
+	int violations = 0;
+	int broken = 0;
+	for (int i = start; i < end; i++) {
+		if (c->broken[i]) continue;
+		Body* body1 = &objects[c->idx1[i]];
+		Body* body2 = &objects[c->idx2[i]];
+		Vector2* object1 = &body1->position;
+		Vector2* object2 = &body2->position;
+		float dx = object1->x - object2->x;
+		float dy = object1->y - object2->y;
+		float distance = sqrtf(dx * dx + dy * dy);
+		if (distance > c->length[i]) {
+			// All objects have the same mass, so the weights of both objects are 1, or 0 for a sleeping object that stays asleep
+			float weight1 = 1, weight2 = 1;
+			if (physics_asleep(body1) || physics_asleep(body2)) {
+				if (physics_asleep(body1) && physics_asleep(body2)) continue;
+				Body* sleeping = physics_asleep(body1) ? body1 : body2;
+				Body* moving = physics_asleep(body1) ? body2 : body1;
+				if (physics_speed2(moving) > wake * wake) {
+					physics_wake(sleeping);
+				} else {
+					weight1 = physics_asleep(body1) ? 0 : 1;
+					weight2 = 1 - weight1;
+				}
+			}
+			violations++;
+			float alpha = c->compliance[i] * inverse_dt2;
+			float correction = (distance - c->length[i] - alpha * c->lambda[i]) / (weight1 + weight2 + alpha);
+			c->lambda[i] += correction;
+			float scale = correction / distance;
+			object1->x -= dx * scale * weight1;
+			object1->y -= dy * scale * weight1;
+			object2->x += dx * scale * weight2;
+			object2->y += dy * scale * weight2;
+			if (break_distance > 0 && correction > break_distance) {
+				c->broken[i] = 1;
+				broken++;
+			}
+		}
+	}
+	PHYSICS_STAT(constraint_violations, violations);
+	PHYSICS_STAT(constraints_broken, broken);
+}
+
+// Solve every constraint in the store once, call this every timestep, more times to make constraints more rigid.
+void distance_constraints_solve(World* w, DistanceConstraints* c) {
+	distance_constraints_sync(w, c);
+	distance_constraints_solve_range(w, c, 0, c->size);
+}
+
+#endif
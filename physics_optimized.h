@@ -1,15 +1,23 @@
+#ifndef HAS_PHYSICS_OPTIMIZED
+#define HAS_PHYSICS_OPTIMIZED 1
+
 #include "physics.h"
-#include <assert.h>
 
 /////////////////
 // Access Grid //
 ////////////////
 
-#define MAX_PARTICLES_IN_CELL 256
-
 // A datastructure used to optimize collision detection
 // This works by breaking up space into a array of grid cells, binning all objects into a cell, to be able to quickly find nearby objects.
 // Basicly, this is a database allowing fast lookup of particles in a location
+//
+// The grid is rebuilt from scratch by access_grid_populate using a counting sort, so all the cells are stored in a single array,
+// one after another. There is no limit on the number of objects in a cell. Memory use is one int per cell (where it's objects start) plus
+// two per object (the sorted indices and the cell of every object), there is no fixed array of slots for every cell.
+// Every object is put in the single cell containing it's center, collisions are found by checking nearby cells.
+//
+// access_grid_update does the same thing, but only moves the objects that changed cells since the last build, which is much
+// cheaper when most objects are at rest.
 typedef struct AccessGrid {
 	float start_x;
 	float start_y;
@@ -17,8 +25,22 @@ typedef struct AccessGrid {
 
 	int x_size;
 	int y_size;
-	int** object_list_length;
-	int** object_list;
+	// The largest radius binned by the last call to access_grid_populate
+	float max_radius;
+	// How many cells away a colliding object can be, this is 1 unless the cell size is less than twice max_radius.
+	int reach;
+	// The objects in cell number c are .objects[.cell_start[c]] up to .objects[.cell_start[c + 1]]
+	// Cells are numbered x * y_size + y, so the cells of a column are next to each other.
+	// Objects outside of the grid are kept after the last cell, as if in cell x_size * y_size, so this has x_size * y_size + 2 entries.
+	int* cell_start;
+	// Indecies of objects, sorted by cell. This grows as needed.
+	int* objects;
+	// The cell number of every object in the world, or -1 if it is outside the grid. This has .objects_capacity entries.
+	int* object_cell;
+	int objects_capacity;
+	// The size and World.reorders of the world when the grid was built, if either changed access_grid_update has to rebuild the grid.
+	int object_count;
+	int world_reorders;
 } AccessGrid;
 
 // x and y are the size, this should be the total width and height of the area objects are allowed to enter devided by the cellsize. 
@@ -31,121 +53,684 @@ AccessGrid new_access_grid(int x, int y, float start_x, float start_y, float cel
 		.start_y = start_y,
 		.x_size = x,
 		.y_size = y,
-		.object_list_length = malloc(x * sizeof(int*)),
-		.object_list = malloc(x * sizeof(int**)),
+		.max_radius = 0,
+		.reach = 1,
+		.cell_start = calloc(x * y + 2, sizeof(int)),
+		.objects = 0,
+		.object_cell = 0,
+		.objects_capacity = 0,
+		.object_count = -1,
+		.world_reorders = 0,
 	};
-	
- 	for (int cx = 0; cx < x; cx++) {
-		grid.object_list_length[cx] = malloc(x * sizeof(int));
-		grid.object_list[cx] = malloc(y * sizeof(int*) * MAX_PARTICLES_IN_CELL);
-		for (int cy = 0; cy < y; cy++) {
-			grid.object_list_length[cx][cy] = 0;
-		}
-	}
 	return grid;
 }
 
 void free_access_grid(AccessGrid* grid) {
-	for (int x = 0; x < grid->x_size; x++) {
-		free(grid->object_list_length[x]);
-		free(grid->object_list[x]);
-	}
+	free(grid->cell_start);
+	free(grid->objects);
+	free(grid->object_cell);
+	grid->cell_start = 0;
+	grid->objects = 0;
+	grid->object_cell = 0;
+	grid->objects_capacity = 0;
+	grid->object_count = -1;
 }
 
+// Get the objects in a cell, use access_grid_length to get how many there are.
 int* access_grid_get(AccessGrid* grid, int x, int y) {
-	return &grid->object_list[x][y * MAX_PARTICLES_IN_CELL];
+	return &grid->objects[grid->cell_start[x * grid->y_size + y]];
 }
 
-void access_grid_clear(AccessGrid* grid) {
-	for (int x = 0; x < grid->x_size; x++)
-		for (int y = 0; y < grid->y_size; y++)
-			grid->object_list_length[x][y] = 0;
+// Get the number of objects in a cell
+int access_grid_length(AccessGrid* grid, int x, int y) {
+	int cell = x * grid->y_size + y;
+	return grid->cell_start[cell + 1] - grid->cell_start[cell];
 }
 
-void access_grid_append(AccessGrid* grid, int x, int y, int idx) {	
-	if (grid->object_list_length[x][y] < MAX_PARTICLES_IN_CELL) {
-		int position = grid->object_list_length[x][y]++;
-		access_grid_get(grid, x, y)[position] = idx;
-	} 
+// Get the cell containing a cordinate, start should be the grid's start_x or start_y.
+// This can be outside of the grid.
+int access_grid_cell(AccessGrid* grid, float cordinate, float start) {
+	return (int)floorf((cordinate - start) / grid->cellsize);
 }
 
-////////////////////
-// Physics solver //
-////////////////////
+// Get the cell number of the cell containing a point, or -1 if it is outside of the grid
+int access_grid_cell_number(AccessGrid* grid, Vector2 location) {
+	int cellx = access_grid_cell(grid, location.x, grid->start_x);
+	int celly = access_grid_cell(grid, location.y, grid->start_y);
+	if (cellx >= 0 && cellx < grid->x_size && celly >= 0 && celly < grid->y_size) return cellx * grid->y_size + celly;
+	return -1;
+}
+
+// Rebuild the grid, binning every object into the cell containing it's center. Objects outside of the grid don't collide.
+void access_grid_populate(World* w, AccessGrid* grid) {
+	int cells = grid->x_size * grid->y_size;
+	int* cell_start = grid->cell_start;
+	for (int c = 0; c <= cells + 1; c++) cell_start[c] = 0;
+	grid->max_radius = 0;
+	grid->object_count = w->size;
+	grid->world_reorders = w->reorders;
+	PHYSICS_STAT(grid_rebuilds, 1);
+
+	if (w->size > grid->objects_capacity) {
+		int capacity = grid->objects_capacity * 2;
+		if (capacity < w->size) capacity = w->size;
+		free(grid->objects);
+		free(grid->object_cell);
+		grid->objects = malloc(capacity * sizeof(int));
+		grid->object_cell = malloc(capacity * sizeof(int));
+		grid->objects_capacity = capacity;
+	}
+
+	// Count how many objects go into each cell
+	for (int i = 0; i < w->size; i++) {
+		float radius = w->objects[i].radius;
+		if (radius > grid->max_radius) grid->max_radius = radius;
+		
+		int cell = access_grid_cell_number(grid, w->objects[i].position);
+		cell_start[cell >= 0 ? cell : cells]++;
+		grid->object_cell[i] = cell;
+	}
+	PHYSICS_STAT(objects_outside_grid, cell_start[cells]);
+
+	// Colliding objects are at most twice the largest radius apart
+	grid->reach = (int)ceilf(2 * grid->max_radius / grid->cellsize);
+	if (grid->reach < 1) grid->reach = 1;
+
+	// Turn the counts into the index one past the end of every cell
+	int total = 0;
+	for (int c = 0; c <= cells; c++) {
+		total += cell_start[c];
+		cell_start[c] = total;
+	}
+	cell_start[cells + 1] = total;
+
+	// Fill in the cells from the back, which leaves cell_start pointing to the start of every cell.
+	// Going through the objects backwards keeps every cell sorted by index (until access_grid_update moves objects around).
+	for (int i = w->size - 1; i >= 0; i--) {
+		int cell = grid->object_cell[i];
+		grid->objects[--cell_start[cell >= 0 ? cell : cells]] = i;
+	}
+}
+
+// Move object idx from cell from to cell to, using cells one past the last for objects outside of the grid.
+// The object is passed along through every cell in between, swapping places with the last (or first) object in each cell and moving
+// the edge of the cell over it, so this takes one step per cell, objects usually only move one cell up, down or sideways (y_size cells).
+void access_grid_move(AccessGrid* grid, int idx, int from, int to) {
+	int* cell_start = grid->cell_start;
+	int* objects = grid->objects;
+	int slot = cell_start[from];
+	while (objects[slot] != idx) slot++;
+
+	for (int c = from; c < to; c++) {
+		// Swap to the end of cell c, then make that the start of cell c + 1
+		int last = cell_start[c + 1] - 1;
+		objects[slot] = objects[last];
+		objects[last] = idx;
+		slot = last;
+		cell_start[c + 1]--;
+	}
+	for (int c = from; c > to; c--) {
+		// Swap to the start of cell c, then make that the end of cell c - 1
+		int first = cell_start[c];
+		objects[slot] = objects[first];
+		objects[first] = idx;
+		slot = first;
+		cell_start[c]++;
+	}
+}
+
+// Bring the grid up to date, like access_grid_populate, but only moving the objects that changed cells since the last build.
+// This falls back to a full rebuild if the world changed size or was reordered, or if moving the objects would take longer than rebuilding.
+// Returns the number of objects that moved, or -1 if the grid was rebuilt.
+int access_grid_update(World* w, AccessGrid* grid) {
+	if (w->size != grid->object_count || w->reorders != grid->world_reorders) {
+		access_grid_populate(w, grid);
+		return -1;
+	}
+
+	int cells = grid->x_size * grid->y_size;
+	// A rebuild touches every cell and every object, stop once moving objects costs more than that.
+	int budget = cells + w->size;
+	int moved = 0;
+	grid->max_radius = 0;
+	for (int i = 0; i < w->size; i++) {
+		float radius = w->objects[i].radius;
+		if (radius > grid->max_radius) grid->max_radius = radius;
+
+		int cell = access_grid_cell_number(grid, w->objects[i].position);
+		int old = grid->object_cell[i];
+		if (cell == old) continue;
+
+		int from = old >= 0 ? old : cells;
+		int to = cell >= 0 ? cell : cells;
+		budget -= abs(to - from);
+		if (budget < 0) {
+			access_grid_populate(w, grid);
+			return -1;
+		}
+		access_grid_move(grid, i, from, to);
+		grid->object_cell[i] = cell;
+		moved++;
+	}
 
-void physics_single_check(World* w, int idx1, int idx2) {
-	// Avoid checking a cell against itself
-	if (idx1 == idx2) return;
-	// Avoid duplicate checks
-	if (idx1 < idx2) return;
-	float mindistance = w->objects[idx1].radius + w->objects[idx2].radius;
+	grid->reach = (int)ceilf(2 * grid->max_radius / grid->cellsize);
+	if (grid->reach < 1) grid->reach = 1;
+	PHYSICS_STAT(grid_objects_moved, moved);
+	PHYSICS_STAT(objects_outside_grid, grid->cell_start[cells + 1] - grid->cell_start[cells]);
+	return moved;
+}
 
-	Vector2* object1 = &w->objects[idx1].position;
-	Vector2* object2 = &w->objects[idx2].position;
-	Vector2 difference = vector_sub(*object1, *object2);
+// Reorder the objects in a world by the grid cell they are in, so objects close to each other in space are close to each other in memory.
+// This makes collision checks access memory in order, objects don't move far in a second, so sorting
+// once every 60 frames (like the stress test and export do) is enough to keep a large simulation sorted.
+//
+// This changes the index of objects, so use world_body_index to find objects by id afterwards.
+// Objects outside of the grid are moved to the end. The grid is not updated, but the next build rebuilds it anyway.
+void world_spatial_sort(World* w, AccessGrid* grid) {
+	int cells = grid->x_size * grid->y_size;
+	// One extra bucket, for objects outside of the grid
+	int* bucket_start = calloc(cells + 2, sizeof(int));
+	int* keys = malloc(w->size * sizeof(int));
+	Body* sorted = malloc(w->size * sizeof(Body));
+	int* sorted_ids = malloc(w->size * sizeof(int));
+
+	for (int i = 0; i < w->size; i++) {
+		int x = access_grid_cell(grid, w->objects[i].position.x, grid->start_x);
+		int y = access_grid_cell(grid, w->objects[i].position.y, grid->start_y);
+		int key = cells;
+		if (x >= 0 && x < grid->x_size && y >= 0 && y < grid->y_size) key = x * grid->y_size + y;
+		keys[i] = key;
+		bucket_start[key + 1]++;
+	}
+	for (int b = 0; b <= cells; b++) bucket_start[b + 1] += bucket_start[b];
 
-	float distance = vector_length(difference);
+	// Stable, objects in the same cell keep their order
+	for (int i = 0; i < w->size; i++) {
+		int position = bucket_start[keys[i]]++;
+		sorted[position] = w->objects[i];
+		sorted_ids[position] = w->ids ? w->ids[i] : i;
+	}
 
-	// Check for intersections
-	if (mindistance > distance) {
-		float delta = (mindistance - distance) / 2;
-		Vector2 adjustment = vector_mul_scaler(vector_mul_scaler(difference, 1.0/distance), delta);
-		*object1 = vector_add(*object1, adjustment);
-		*object2 = vector_sub(*object2, adjustment);
+	for (int i = 0; i < w->size; i++) w->objects[i] = sorted[i];
+	if (w->ids) {
+		for (int i = 0; i < w->size; i++) {
+			w->ids[i] = sorted_ids[i];
+			w->indices[sorted_ids[i]] = i;
+		}
 	}
 
+	w->reorders++;
+
+	free(bucket_start);
+	free(keys);
+	free(sorted);
+	free(sorted_ids);
 }
 
-// Do collison checks between all cells in 
-void collide_with_cell(World* w, AccessGrid* grid, int x, int y, int idx) {
-	if (x < 0 || x >= grid->x_size || y < 0 || y >= grid->y_size) return;
+////////////////////
+// Physics solver //
+////////////////////
+
+// Move two objects apart if they intersect, returns 1 if they did.
+int physics_pair_check(World* w, int idx1, int idx2) {
+	return world_collide_pair(w, idx1, idx2);
+}
 
+// Do collision checks between the objects in a cell, and between them and the objects in half of the surrounding cells.
+// Only the cells after this one (to the right, or above in the same column) are checked, the rest are handled when
+// visiting those cells, so every pair of cells is only checked once.
+// This only touches objects in columns x to x + grid->reach, so columns further apart can be handled at the same time.
+void access_grid_collide_cell(World* w, AccessGrid* grid, int x, int y) {
 	int* indecies = access_grid_get(grid, x, y);
-	int length = grid->object_list_length[x][y];
+	int length = access_grid_length(grid, x, y);
+	PHYSICS_STAT(cells_visited, 1);
+	if (length == 0) return;
+
+	// Counted here and added once, so threads don't fight over the counters
+	int pairs = length * (length - 1) / 2;
+	int contacts = 0;
+
+	// Pairs inside this cell
 	for (int i = 0; i < length; i++)
-		physics_single_check(w, idx, indecies[i]);
+		for (int e = i + 1; e < length; e++)
+			contacts += physics_pair_check(w, indecies[i], indecies[e]);
+
+	int reach = grid->reach;
+	for (int dx = 0; dx <= reach; dx++) {
+		int nx = x + dx;
+		if (nx >= grid->x_size) break;
+		// In the same column only the cells above this one are after it
+		for (int dy = dx == 0 ? 1 : -reach; dy <= reach; dy++) {
+			int ny = y + dy;
+			if (ny < 0 || ny >= grid->y_size) continue;
+
+			int* others = access_grid_get(grid, nx, ny);
+			int other_length = access_grid_length(grid, nx, ny);
+			pairs += length * other_length;
+			for (int i = 0; i < length; i++)
+				for (int e = 0; e < other_length; e++)
+					contacts += physics_pair_check(w, indecies[i], others[e]);
+		}
+	}
+	PHYSICS_STAT(pairs_tested, pairs);
+	PHYSICS_STAT(contacts_resolved, contacts);
+}
+
+// Do collision checks for every cell, using the grid built by the last access_grid_populate call.
+void access_grid_collide(World* w, AccessGrid* grid) {
+	for (int x = 0; x < grid->x_size; x++)
+		for (int y = 0; y < grid->y_size; y++)
+			access_grid_collide_cell(w, grid, x, y);
 }
 
 // An optiminzed collision solver
-// max_x, min_x, max_y, min_y are the dimentrions for any particles
-// Cell size should be the twice largest radius in the simulation, but violating this will no longer break things.
+// The grid should cover the whole area objects are in, objects outside of it don't collide.
+// Cell size should be the twice largest radius in the simulation, smaller cells work, but more of them have to be checked.
 void world_optimized_collide(World* w, AccessGrid* grid) {
 	// Populate the access grid with all the particles
+	access_grid_populate(w, grid);
+	access_grid_collide(w, grid);
+}
+
+// world_optimized_collide for StepSettings.collide, set .collide_data to the AccessGrid.
+void step_optimized_collide(World* w, void* grid) {
+	world_optimized_collide(w, grid);
+}
+
+// Like world_optimized_collide, but only moving the objects that changed cells since the last call, see access_grid_update.
+void world_incremental_collide(World* w, AccessGrid* grid) {
+	access_grid_update(w, grid);
+	access_grid_collide(w, grid);
+}
+
+// access_grid_update for StepSettings.broad_phase, set .broad_phase_data to the AccessGrid.
+// Together with step_grid_collide, this updates the grid once per substep, and reuses it for every collision iteration.
+void step_update_grid(World* w, void* grid) {
+	access_grid_update(w, grid);
+}
+
+// access_grid_collide for StepSettings.collide, using the grid as it is, set .collide_data to the AccessGrid.
+void step_grid_collide(World* w, void* grid) {
+	access_grid_collide(w, grid);
+}
+
+///////////////
+// Hash Grid //
+///////////////
+
+// A version of the AccessGrid for worlds without fixed bounds.
+// Instead of storing every cell, cells are hashed into a fixed number of buckets, so it works for any cordinates,
+// and the memory used depends on the number of buckets and objects, not the size of the world.
+// Cells that share a bucket just cause a few extra checks. For performace, use about as many buckets as objects.
+typedef struct HashGrid {
+	float cellsize;
+	int table_size;
+
+	// The largest radius binned by the last call to hash_grid_populate
+	float max_radius;
+	// How many cells away a colliding object can be, see AccessGrid
+	int reach;
+	// The objects in bucket b are .objects[.bucket_start[b]] up to .objects[.bucket_start[b + 1]]
+	// This has table_size + 1 entries.
+	int* bucket_start;
+	// Indecies of objects sorted by bucket, and the bucket of every object. These grow as needed.
+	int* objects;
+	int* object_bucket;
+	// The cell of every object when the grid was built, collisions are found from these, not the current positions,
+	// so every object is looked for in the same place it was binned.
+	int* object_x;
+	int* object_y;
+	int objects_capacity;
+	// Scratch space for hash_grid_collide, the buckets of the cells after the last cell looked at.
+	int* query;
+	int query_capacity;
+} HashGrid;
+
+// table_size is the number of buckets, cellsize works the same as for new_access_grid.
+HashGrid new_hash_grid(int table_size, float cellsize) {
+	HashGrid grid = {
+		.cellsize = cellsize,
+		.table_size = table_size,
+		.max_radius = 0,
+		.reach = 1,
+		.bucket_start = calloc(table_size + 1, sizeof(int)),
+		.objects = 0,
+		.object_bucket = 0,
+		.object_x = 0,
+		.object_y = 0,
+		.objects_capacity = 0,
+		.query = 0,
+		.query_capacity = 0,
+	};
+	return grid;
+}
+
+void free_hash_grid(HashGrid* grid) {
+	free(grid->bucket_start);
+	free(grid->objects);
+	free(grid->object_bucket);
+	free(grid->object_x);
+	free(grid->object_y);
+	free(grid->query);
+	grid->bucket_start = 0;
+	grid->objects = 0;
+	grid->object_bucket = 0;
+	grid->object_x = 0;
+	grid->object_y = 0;
+	grid->query = 0;
+	grid->objects_capacity = 0;
+	grid->query_capacity = 0;
+}
+
+// Get the bucket a cell is stored in
+int hash_grid_bucket(HashGrid* grid, int x, int y) {
+	unsigned int hash = ((unsigned int)x * 73856093u) ^ ((unsigned int)y * 19349663u);
+	return hash % (unsigned int)grid->table_size;
+}
+
+// Get the cell containing a cordinate
+int hash_grid_cell(HashGrid* grid, float cordinate) {
+	return (int)floorf(cordinate / grid->cellsize);
+}
+
+// Rebuild the grid, binning every object into the bucket of the cell containing it's center.
+void hash_grid_populate(World* w, HashGrid* grid) {
+	int* bucket_start = grid->bucket_start;
+	for (int b = 0; b <= grid->table_size; b++) bucket_start[b] = 0;
+	grid->max_radius = 0;
+
+	if (w->size > grid->objects_capacity) {
+		int capacity = grid->objects_capacity * 2;
+		if (capacity < w->size) capacity = w->size;
+		free(grid->objects);
+		free(grid->object_bucket);
+		free(grid->object_x);
+		free(grid->object_y);
+		grid->objects = malloc(capacity * sizeof(int));
+		grid->object_bucket = malloc(capacity * sizeof(int));
+		grid->object_x = malloc(capacity * sizeof(int));
+		grid->object_y = malloc(capacity * sizeof(int));
+		grid->objects_capacity = capacity;
+	}
 
-	access_grid_clear(grid);
-	
 	for (int i = 0; i < w->size; i++) {
 		Vector2 location = w->objects[i].position;
-		float radius = w->objects[i].radius;
-		
-		int grid_x_start = 	((int)(location.x - radius - grid->start_x)/grid->cellsize);
-		int grid_x_end = 	((int)(location.x + radius - grid->start_x)/grid->cellsize);
-		int grid_y_start = 	((int)(location.y - radius - grid->start_y)/grid->cellsize);
-		int grid_y_end = 	((int)(location.y + radius - grid->start_y)/grid->cellsize);
-	
-		for (int cellx = grid_x_start; cellx <= grid_x_end; cellx++) {
-			for (int celly = grid_y_start; celly <= grid_y_end; celly++) {
-				if (cellx >= 0 && cellx < grid->x_size && celly >= 0 && celly < grid->y_size ) {
-					access_grid_append(grid, cellx, celly, i);
-				}
+		if (w->objects[i].radius > grid->max_radius) grid->max_radius = w->objects[i].radius;
+		int x = hash_grid_cell(grid, location.x);
+		int y = hash_grid_cell(grid, location.y);
+		int bucket = hash_grid_bucket(grid, x, y);
+		grid->object_x[i] = x;
+		grid->object_y[i] = y;
+		grid->object_bucket[i] = bucket;
+		bucket_start[bucket]++;
+	}
+
+	grid->reach = (int)ceilf(2 * grid->max_radius / grid->cellsize);
+	if (grid->reach < 1) grid->reach = 1;
+	int query_size = (2 * grid->reach + 1) * (2 * grid->reach + 1);
+	if (query_size > grid->query_capacity) {
+		free(grid->query);
+		grid->query = malloc(query_size * sizeof(int));
+		grid->query_capacity = query_size;
+	}
+
+	// Same counting sort as access_grid_populate
+	int total = 0;
+	for (int b = 0; b < grid->table_size; b++) {
+		total += bucket_start[b];
+		bucket_start[b] = total;
+	}
+	bucket_start[grid->table_size] = total;
+
+	for (int i = w->size - 1; i >= 0; i--) {
+		grid->objects[--bucket_start[grid->object_bucket[i]]] = i;
+	}
+}
+
+// Put the buckets of the cells after cell x, y in .query, in the same order as access_grid_collide_cell visits them.
+// Nearby cells can share a bucket, then it is in .query more than once, once for every cell.
+void hash_grid_query(HashGrid* grid, int x, int y) {
+	int reach = grid->reach;
+	int query_size = 0;
+	for (int dx = 0; dx <= reach; dx++)
+		for (int dy = dx == 0 ? 1 : -reach; dy <= reach; dy++)
+			grid->query[query_size++] = hash_grid_bucket(grid, x + dx, y + dy);
+}
+
+// Do collision checks between the object at .objects[position] and every object after it in the same cell,
+// and every object in the cells after it, which are in .query.
+// Buckets hold every cell that hashes to them, so only objects binned in the right cell are checked.
+void hash_grid_collide_object(World* w, HashGrid* grid, int position) {
+	int idx = grid->objects[position];
+	int x = grid->object_x[idx];
+	int y = grid->object_y[idx];
+	int pairs = 0;
+	int contacts = 0;
+
+	// Pairs inside this cell, the other object has to be later in the bucket so every pair is only checked once
+	int end = grid->bucket_start[grid->object_bucket[idx] + 1];
+	for (int i = position + 1; i < end; i++) {
+		int other = grid->objects[i];
+		if (grid->object_x[other] != x || grid->object_y[other] != y) continue;
+		contacts += physics_pair_check(w, idx, other);
+		pairs++;
+	}
+
+	int reach = grid->reach;
+	int q = 0;
+	for (int dx = 0; dx <= reach; dx++) {
+		for (int dy = dx == 0 ? 1 : -reach; dy <= reach; dy++) {
+			int bucket = grid->query[q++];
+			for (int i = grid->bucket_start[bucket]; i < grid->bucket_start[bucket + 1]; i++) {
+				int other = grid->objects[i];
+				if (grid->object_x[other] != x + dx || grid->object_y[other] != y + dy) continue;
+				contacts += physics_pair_check(w, idx, other);
+				pairs++;
 			}
 		}
 	}
+	PHYSICS_STAT(pairs_tested, pairs);
+	PHYSICS_STAT(contacts_resolved, contacts);
+}
 
-	for (int i = 0; i < w->size; i++) {	
-		Vector2 location = w->objects[i].position;
-		float radius = w->objects[i].radius;
-	
-		int grid_x_start = 	((int)(location.x - radius - grid->start_x)/grid->cellsize);
-		int grid_x_end = 	((int)(location.x + radius - grid->start_x)/grid->cellsize);
-		int grid_y_start = 	((int)(location.y - radius - grid->start_y)/grid->cellsize);
-		int grid_y_end = 	((int)(location.y + radius - grid->start_y)/grid->cellsize);
-
-		for (int check_x = grid_x_start; check_x <= grid_x_end; check_x++) {
-			for (int check_y = grid_y_start; check_y <= grid_y_end; check_y++) {
-				collide_with_cell(w, grid, check_x, check_y, i);
+// Do collision checks for every object, using the grid built by the last hash_grid_populate call.
+// Objects are visited bucket by bucket, so the nearby buckets are only hashed once for all the objects of a cell next to each other.
+void hash_grid_collide(World* w, HashGrid* grid) {
+	int count = grid->bucket_start[grid->table_size];
+	int x = 0, y = 0;
+	for (int i = 0; i < count; i++) {
+		int idx = grid->objects[i];
+		if (i == 0 || grid->object_x[idx] != x || grid->object_y[idx] != y) {
+			x = grid->object_x[idx];
+			y = grid->object_y[idx];
+			hash_grid_query(grid, x, y);
+			PHYSICS_STAT(cells_visited, 1);
+		}
+		hash_grid_collide_object(w, grid, i);
+	}
+}
+
+// A collision solver for worlds of any size, using a HashGrid instead of an AccessGrid.
+// Cell size should be the twice largest radius in the simulation, smaller cells work, but more of them have to be checked.
+void world_hashed_collide(World* w, HashGrid* grid) {
+	hash_grid_populate(w, grid);
+	hash_grid_collide(w, grid);
+}
+
+// world_hashed_collide for StepSettings.collide, set .collide_data to the HashGrid.
+void step_hashed_collide(World* w, void* grid) {
+	world_hashed_collide(w, grid);
+}
+
+///////////////////
+// Contact cache //
+///////////////////
+
+// A list of pairs of objects that are close to each other, so collision iterations can loop over just those pairs instead of
+// searching the grid every time. Pairs are found with a margin, so the list stays valid until some object has moved more than
+// half the margin, which with small timesteps is usually many substeps. Building the list costs more than a grid collision
+// iteration, so this pays off when objects move slowly, like in cloth or a settled pile.
+//
+// Use world_cached_collide instead of world_optimized_collide, or step_update_contacts and step_contact_collide with world_step.
+typedef struct ContactCache {
+	// How much further apart than touching objects can be and still be in the list, larger margins mean more pairs, but fewer rebuilds.
+	float margin;
+	// Pairs of object indices, pair p is .pairs[p * 2] and .pairs[p * 2 + 1].
+	int* pairs;
+	int pair_count;
+	int pair_capacity;
+	// Where every object was when the list was built, and the size and World.reorders of the world at that point.
+	Vector2* built_at;
+	int built_capacity;
+	int object_count;
+	int world_reorders;
+	// How many times the list has been built, useful for tuning the margin.
+	int builds;
+} ContactCache;
+
+ContactCache new_contact_cache(float margin) {
+	ContactCache cache = {
+		.margin = margin,
+		.pairs = 0,
+		.pair_count = 0,
+		.pair_capacity = 0,
+		.built_at = 0,
+		.built_capacity = 0,
+		.object_count = -1,
+		.world_reorders = 0,
+		.builds = 0
+	};
+	return cache;
+}
+
+void free_contact_cache(ContactCache* cache) {
+	free(cache->pairs);
+	free(cache->built_at);
+	cache->pairs = 0;
+	cache->built_at = 0;
+	cache->pair_count = 0;
+	cache->pair_capacity = 0;
+	cache->built_capacity = 0;
+	cache->object_count = -1;
+}
+
+// Add a pair to the list if the objects are within the margin of touching
+void contact_cache_check(World* w, ContactCache* cache, int idx1, int idx2) {
+	Body* body1 = &w->objects[idx1];
+	Body* body2 = &w->objects[idx2];
+	float reach = body1->radius + body2->radius + cache->margin;
+	float dx = body1->position.x - body2->position.x;
+	float dy = body1->position.y - body2->position.y;
+	if (dx * dx + dy * dy >= reach * reach) return;
+
+	if (cache->pair_count >= cache->pair_capacity) {
+		cache->pair_capacity = cache->pair_capacity * 2;
+		if (cache->pair_capacity < 64) cache->pair_capacity = 64;
+		cache->pairs = realloc(cache->pairs, cache->pair_capacity * 2 * sizeof(int));
+	}
+	cache->pairs[cache->pair_count * 2] = idx1;
+	cache->pairs[cache->pair_count * 2 + 1] = idx2;
+	cache->pair_count++;
+}
+
+// Rebuild the list, using the grid to find nearby objects. This brings the grid up to date with access_grid_update.
+void contact_cache_build(World* w, AccessGrid* grid, ContactCache* cache) {
+	access_grid_update(w, grid);
+	cache->pair_count = 0;
+	cache->builds++;
+	PHYSICS_STAT(contact_cache_builds, 1);
+
+	if (w->size > cache->built_capacity) {
+		free(cache->built_at);
+		cache->built_capacity = w->size;
+		cache->built_at = malloc(cache->built_capacity * sizeof(Vector2));
+	}
+	for (int i = 0; i < w->size; i++) cache->built_at[i] = w->objects[i].position;
+	cache->object_count = w->size;
+	cache->world_reorders = w->reorders;
+
+	// Same as access_grid_collide_cell, but the margin can make the reach larger than the grid's.
+	int reach = (int)ceilf((2 * grid->max_radius + cache->margin) / grid->cellsize);
+	if (reach < 1) reach = 1;
+	for (int x = 0; x < grid->x_size; x++) {
+		for (int y = 0; y < grid->y_size; y++) {
+			int* indecies = access_grid_get(grid, x, y);
+			int length = access_grid_length(grid, x, y);
+			if (length == 0) continue;
+
+			for (int i = 0; i < length; i++)
+				for (int e = i + 1; e < length; e++)
+					contact_cache_check(w, cache, indecies[i], indecies[e]);
+
+			for (int dx = 0; dx <= reach; dx++) {
+				int nx = x + dx;
+				if (nx >= grid->x_size) break;
+				for (int dy = dx == 0 ? 1 : -reach; dy <= reach; dy++) {
+					int ny = y + dy;
+					if (ny < 0 || ny >= grid->y_size) continue;
+
+					int* others = access_grid_get(grid, nx, ny);
+					int other_length = access_grid_length(grid, nx, ny);
+					for (int i = 0; i < length; i++)
+						for (int e = 0; e < other_length; e++)
+							contact_cache_check(w, cache, indecies[i], others[e]);
+				}
 			}
 		}
 	}
 }
 
+// Check if the list is out of date, which is when the world has changed size or been reordered,
+// or any object has moved more than half the margin since it was built (two objects moving towards each other could then touch).
+int contact_cache_stale(World* w, ContactCache* cache) {
+	if (w->size != cache->object_count || w->reorders != cache->world_reorders) return 1;
+	float limit = cache->margin / 2;
+	float limit2 = limit * limit;
+	for (int i = 0; i < w->size; i++) {
+		float dx = w->objects[i].position.x - cache->built_at[i].x;
+		float dy = w->objects[i].position.y - cache->built_at[i].y;
+		if (dx * dx + dy * dy > limit2) return 1;
+	}
+	return 0;
+}
+
+// Rebuild the list if it is out of date
+void contact_cache_update(World* w, AccessGrid* grid, ContactCache* cache) {
+	if (contact_cache_stale(w, cache)) contact_cache_build(w, grid, cache);
+}
+
+// Run one collision iteration over the pairs in the list, this is a tight loop over a compact array, so is cheap to run many times.
+void contact_cache_collide(World* w, ContactCache* cache) {
+	int* pairs = cache->pairs;
+	int contacts = 0;
+	for (int p = 0; p < cache->pair_count; p++)
+		contacts += world_collide_pair(w, pairs[p * 2], pairs[p * 2 + 1]);
+	PHYSICS_STAT(pairs_tested, cache->pair_count);
+	PHYSICS_STAT(contacts_resolved, contacts);
+}
+
+// A collision solver using a contact cache, the grid works the same way as for world_optimized_collide.
+void world_cached_collide(World* w, AccessGrid* grid, ContactCache* cache) {
+	contact_cache_update(w, grid, cache);
+	contact_cache_collide(w, cache);
+}
+
+// What to pass as StepSettings.broad_phase_data and .collide_data with step_update_contacts and step_contact_collide
+typedef struct CachedCollide {
+	AccessGrid* grid;
+	ContactCache* cache;
+} CachedCollide;
+
+// contact_cache_update for StepSettings.broad_phase, set .broad_phase_data to a CachedCollide.
+void step_update_contacts(World* w, void* data) {
+	CachedCollide* collide = data;
+	contact_cache_update(w, collide->grid, collide->cache);
+}
+
+// contact_cache_collide for StepSettings.collide, set .collide_data to the same CachedCollide as .broad_phase_data.
+void step_contact_collide(World* w, void* data) {
+	CachedCollide* collide = data;
+	contact_cache_collide(w, collide->cache);
+}
+
+#endif
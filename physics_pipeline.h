@@ -0,0 +1,100 @@
+// Running the simulation on it's own thread, while another thread (usually the main one, since SDL wants that) draws it.
+//
+// The simulation thread copies the world into one of three frames after every step with frame_buffers_publish,
+// and the drawing thread takes the newest one with frame_buffers_latest. With three frames, one is being filled,
+// one is being drawn and one holds the newest finished frame, so neither thread ever has to wait for the other:
+// the simulation can step frame N+1 while frame N is drawn. If the simulation is faster, frames that were never drawn are skipped.
+//
+// Frames are Worlds holding a copy of the objects and ids, so they can be drawn with render_world (see render.h),
+// but they are only a copy, don't step them.
+//
+// Has to be compiled with -lpthread under gcc.
+
+#ifndef HAS_PHYSICS_PIPELINE
+#define HAS_PHYSICS_PIPELINE 1
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "physics.h"
+
+typedef struct FrameBuffers {
+	World frames[3];
+	// The frame being filled by the simulation, the newest finished frame, and the frame being drawn.
+	int back;
+	int ready;
+	int front;
+	// Set if .ready is newer than .front
+	int fresh;
+	// How many frames were published, and how many of those were replaced before being drawn.
+	int published;
+	int skipped;
+	pthread_mutex_t lock;
+} FrameBuffers;
+
+// Allocate frames with space for capacity objects, they grow to fit the world.
+// Call free_frame_buffers when done.
+FrameBuffers* new_frame_buffers(int capacity) {
+	FrameBuffers* buffers = calloc(1, sizeof(FrameBuffers));
+	for (int i = 0; i < 3; i++) buffers->frames[i] = world_with_capacity(capacity);
+	buffers->back = 0;
+	buffers->ready = 1;
+	buffers->front = 2;
+	pthread_mutex_init(&buffers->lock, 0);
+	return buffers;
+}
+
+void free_frame_buffers(FrameBuffers* buffers) {
+	for (int i = 0; i < 3; i++) world_cleanup(&buffers->frames[i]);
+	pthread_mutex_destroy(&buffers->lock);
+	free(buffers);
+}
+
+// Copy the objects and ids of a world into a frame, growing it if needed.
+// Returns 1 if sucessfull, 0 if the frame could not grow, in which case it is left as it was.
+int frame_copy_world(World* frame, World* w) {
+	if (!world_reserve(frame, w->size)) return 0;
+	memcpy(frame->objects, w->objects, w->size * sizeof(Body));
+	if (w->ids) {
+		memcpy(frame->ids, w->ids, w->size * sizeof(int));
+	} else {
+		for (int i = 0; i < w->size; i++) frame->ids[i] = i;
+	}
+	frame->size = w->size;
+	frame->reorders = w->reorders;
+	return 1;
+}
+
+// Copy the world into the back frame and make it the newest one, call from the simulation thread after every step.
+// The copy is done without holding the lock, so this never waits for drawing.
+// Returns 1 if sucessfull, 0 if there was no memory for the copy, then nothing is published and the last frame stays the newest.
+int frame_buffers_publish(FrameBuffers* buffers, World* w) {
+	if (!frame_copy_world(&buffers->frames[buffers->back], w)) return 0;
+
+	pthread_mutex_lock(&buffers->lock);
+	if (buffers->fresh) buffers->skipped++;
+	int ready = buffers->ready;
+	buffers->ready = buffers->back;
+	buffers->back = ready;
+	buffers->fresh = 1;
+	buffers->published++;
+	pthread_mutex_unlock(&buffers->lock);
+	return 1;
+}
+
+// Get the newest frame, call from the drawing thread. The frame stays valid until the next call.
+// If nothing new was published, this is the same frame as last time.
+World* frame_buffers_latest(FrameBuffers* buffers) {
+	pthread_mutex_lock(&buffers->lock);
+	if (buffers->fresh) {
+		int front = buffers->front;
+		buffers->front = buffers->ready;
+		buffers->ready = front;
+		buffers->fresh = 0;
+	}
+	World* frame = &buffers->frames[buffers->front];
+	pthread_mutex_unlock(&buffers->lock);
+	return frame;
+}
+
+#endif
@@ -0,0 +1,558 @@
+// Recording the positions of every object, every frame, to a file for looking at later.
+//
+// Positions are rounded to a fixed precision, and stored as the diffrence from where they would be if they kept moving
+// at the same speed as the last two frames (the same extrapolation Verlet integration does). Objects at rest or in free fall
+// give diffrences of 0 or close to it, which are stored as variable length integers, usually one byte per cordinate.
+// Every few frames (and whenever the objects change) a keyframe with the full positions and ids is written, which
+// the reader can start decoding from, so it can seek to any frame without reading everything before it.
+//
+// Create a recorder with new_trajectory_recorder, and call trajectory_recorder_record after every step. This only copies the
+// positions, the encoding and writing is done on a background thread. If that thread falls behind, frames are dropped
+// instead of waiting, see .dropped_frames. If writing fails (the disk is full...) nothing more is written, see trajectory_recorder_failed.
+// free_trajectory_recorder writes out everything left and closes the file.
+//
+// Read a recording with trajectory_reader_open, trajectory_reader_next and trajectory_reader_seek.
+//
+// Has to be compiled with -lpthread under gcc.
+
+#ifndef HAS_PHYSICS_RECORDER
+#define HAS_PHYSICS_RECORDER 1
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include "physics.h"
+
+#define TRAJECTORY_MAGIC "PHYSTRAJ"
+#define TRAJECTORY_VERSION 1
+
+#define TRAJECTORY_KEYFRAME 1
+#define TRAJECTORY_DELTA 2
+
+// The start of a recording
+typedef struct TrajectoryHeader {
+	char magic[8];
+	uint32_t version;
+	// Size of the units positions are rounded to
+	float precision;
+	uint32_t keyframe_interval;
+} TrajectoryHeader;
+
+// The start of every frame, followed by .payload_size bytes of data.
+// A keyframe is the ids, then the x and then y cordinates, each as the diffrence from the one before it.
+// Any other frame is the diffrence between the predicted and actual x and y of every object.
+typedef struct TrajectoryFrameHeader {
+	uint32_t type;
+	// The number of the frame, frames can be missing if the recorder had to drop them.
+	uint32_t frame;
+	uint32_t count;
+	uint32_t payload_size;
+} TrajectoryFrameHeader;
+
+//////////////
+// Encoding //
+//////////////
+
+// Write a signed integer as a variable length integer, small values (positive or negative) take fewer bytes.
+// Returns the number of bytes written, at most 10.
+int trajectory_put_varint(uint8_t* out, int64_t value) {
+	// Zigzag, so -1 is 1, 1 is 2 and so on
+	uint64_t v = ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+	int length = 0;
+	while (v >= 0x80) {
+		out[length++] = (uint8_t)(v | 0x80);
+		v >>= 7;
+	}
+	out[length++] = (uint8_t)v;
+	return length;
+}
+
+// Read a variable length integer, returns the number of bytes read, or 0 if it runs past end.
+int trajectory_get_varint(const uint8_t* in, const uint8_t* end, int64_t* value) {
+	uint64_t v = 0;
+	int shift = 0;
+	int length = 0;
+	while (in + length < end && shift < 64) {
+		uint8_t byte = in[length++];
+		v |= (uint64_t)(byte & 0x7f) << shift;
+		if (!(byte & 0x80)) {
+			*value = (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+			return length;
+		}
+		shift += 7;
+	}
+	return 0;
+}
+
+// Where an object should be based on the last two frames, or one if there is only one.
+int64_t trajectory_predict(int64_t last, int64_t before_last, int history) {
+	if (history >= 2) return 2 * last - before_last;
+	return last;
+}
+
+///////////////
+// Recording //
+///////////////
+
+// A copy of the positions for one frame, waiting to be written.
+typedef struct TrajectorySlot {
+	float* x;
+	float* y;
+	int* ids;
+	int count;
+	int capacity;
+	int frame;
+	int reorders;
+} TrajectorySlot;
+
+typedef struct TrajectoryRecorder {
+	FILE* file;
+	float precision;
+	int keyframe_interval;
+
+	// A ring of frames waiting to be written, the simulation fills them and the writer thread empties them.
+	TrajectorySlot* slots;
+	int slot_count;
+	int head;
+	int tail;
+	int queued;
+	int quit;
+	pthread_mutex_t lock;
+	pthread_cond_t work_ready;
+	pthread_t thread;
+
+	// Number of frames recorded, and how many of those were dropped because the writer was behind.
+	int frames;
+	int dropped_frames;
+	// Set by the writer thread if writing to the file failed, the file ends at the last complete frame before that.
+	// Nothing is written after a failure. Use trajectory_recorder_failed to read it.
+	int write_failed;
+
+	// Only used by the writer thread: the last two frames written, rounded, for predicting the next one.
+	int64_t* last_x;
+	int64_t* last_y;
+	int64_t* before_x;
+	int64_t* before_y;
+	int history_capacity;
+	int history;
+	int last_count;
+	int last_frame;
+	int last_reorders;
+	int since_keyframe;
+	uint8_t* buffer;
+	size_t buffer_capacity;
+	// Total bytes written, to see how well the recording compresses. Updated by the writer thread, use trajectory_recorder_bytes.
+	size_t bytes_written;
+} TrajectoryRecorder;
+
+// Encode and write one frame, only called on the writer thread. Returns the number of bytes written, or 0 if writing failed.
+size_t trajectory_write_frame(TrajectoryRecorder* rec, TrajectorySlot* slot) {
+	int n = slot->count;
+	if (n > rec->history_capacity) {
+		rec->history_capacity = n;
+		rec->last_x = realloc(rec->last_x, n * sizeof(int64_t));
+		rec->last_y = realloc(rec->last_y, n * sizeof(int64_t));
+		rec->before_x = realloc(rec->before_x, n * sizeof(int64_t));
+		rec->before_y = realloc(rec->before_y, n * sizeof(int64_t));
+	}
+	// Worst case size, 10 bytes for every number
+	size_t needed = (size_t)n * 30;
+	if (needed > rec->buffer_capacity) {
+		rec->buffer_capacity = needed;
+		rec->buffer = realloc(rec->buffer, needed);
+	}
+
+	// Predictions only work if the same objects are in the same order as last frame, and no frames are missing
+	int keyframe = rec->history == 0
+		|| n != rec->last_count
+		|| slot->reorders != rec->last_reorders
+		|| slot->frame != rec->last_frame + 1
+		|| rec->since_keyframe >= rec->keyframe_interval;
+
+	float scale = 1 / rec->precision;
+	uint8_t* out = rec->buffer;
+	size_t size = 0;
+	if (keyframe) {
+		int64_t previous = 0;
+		for (int i = 0; i < n; i++) {
+			size += trajectory_put_varint(out + size, (int64_t)slot->ids[i] - previous);
+			previous = slot->ids[i];
+		}
+		previous = 0;
+		for (int i = 0; i < n; i++) {
+			int64_t q = llrintf(slot->x[i] * scale);
+			size += trajectory_put_varint(out + size, q - previous);
+			previous = q;
+			rec->before_x[i] = rec->last_x[i];
+			rec->last_x[i] = q;
+		}
+		previous = 0;
+		for (int i = 0; i < n; i++) {
+			int64_t q = llrintf(slot->y[i] * scale);
+			size += trajectory_put_varint(out + size, q - previous);
+			previous = q;
+			rec->before_y[i] = rec->last_y[i];
+			rec->last_y[i] = q;
+		}
+		rec->history = 1;
+		rec->since_keyframe = 0;
+	} else {
+		for (int i = 0; i < n; i++) {
+			int64_t qx = llrintf(slot->x[i] * scale);
+			int64_t qy = llrintf(slot->y[i] * scale);
+			size += trajectory_put_varint(out + size, qx - trajectory_predict(rec->last_x[i], rec->before_x[i], rec->history));
+			size += trajectory_put_varint(out + size, qy - trajectory_predict(rec->last_y[i], rec->before_y[i], rec->history));
+			rec->before_x[i] = rec->last_x[i];
+			rec->before_y[i] = rec->last_y[i];
+			rec->last_x[i] = qx;
+			rec->last_y[i] = qy;
+		}
+		rec->history++;
+		rec->since_keyframe++;
+	}
+	rec->last_count = n;
+	rec->last_frame = slot->frame;
+	rec->last_reorders = slot->reorders;
+
+	TrajectoryFrameHeader header = {
+		.type = keyframe ? TRAJECTORY_KEYFRAME : TRAJECTORY_DELTA,
+		.frame = slot->frame,
+		.count = n,
+		.payload_size = size
+	};
+	if (fwrite(&header, sizeof(header), 1, rec->file) != 1) return 0;
+	if (fwrite(out, 1, size, rec->file) != size) return 0;
+	return sizeof(header) + size;
+}
+
+void* trajectory_writer_thread(void* arg) {
+	TrajectoryRecorder* rec = arg;
+	pthread_mutex_lock(&rec->lock);
+	while (1) {
+		while (!rec->quit && rec->queued == 0)
+			pthread_cond_wait(&rec->work_ready, &rec->lock);
+		if (rec->queued == 0) break;
+		TrajectorySlot* slot = &rec->slots[rec->tail];
+		// Only the writer thread sets .write_failed, so it can be read without the lock here
+		int failed = rec->write_failed;
+		// The slot isn't touched by the simulation until it is freed below
+		pthread_mutex_unlock(&rec->lock);
+		// After a failure the file is cut off in the middle of a frame, so anything more would be unreadable
+		size_t bytes = failed ? 0 : trajectory_write_frame(rec, slot);
+		pthread_mutex_lock(&rec->lock);
+		if (bytes == 0) rec->write_failed = 1;
+		rec->bytes_written += bytes;
+		rec->tail = (rec->tail + 1) % rec->slot_count;
+		rec->queued--;
+	}
+	pthread_mutex_unlock(&rec->lock);
+	return 0;
+}
+
+// Start recording to a file. Positions are rounded to multiples of precision, and a keyframe is written at least every keyframe_interval frames.
+// slots is how many frames can be waiting to be written before frames are dropped.
+// Returns null if precision isn't more than 0 or the file can't be written, otherwise call free_trajectory_recorder when done recording.
+TrajectoryRecorder* new_trajectory_recorder(const char* path, float precision, int keyframe_interval, int slots) {
+	// Also catches NaN
+	if (!(precision > 0)) return 0;
+	FILE* file = fopen(path, "wb");
+	if (!file) return 0;
+	if (slots < 1) slots = 1;
+	if (keyframe_interval < 1) keyframe_interval = 1;
+
+	TrajectoryHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, TRAJECTORY_MAGIC, 8);
+	header.version = TRAJECTORY_VERSION;
+	header.precision = precision;
+	header.keyframe_interval = keyframe_interval;
+	if (fwrite(&header, sizeof(header), 1, file) != 1) {
+		fclose(file);
+		return 0;
+	}
+
+	TrajectoryRecorder* rec = calloc(1, sizeof(TrajectoryRecorder));
+	rec->file = file;
+	rec->precision = precision;
+	rec->keyframe_interval = keyframe_interval;
+	rec->slots = calloc(slots, sizeof(TrajectorySlot));
+	rec->slot_count = slots;
+	rec->last_frame = -1;
+	rec->bytes_written = sizeof(header);
+	pthread_mutex_init(&rec->lock, 0);
+	pthread_cond_init(&rec->work_ready, 0);
+	pthread_create(&rec->thread, 0, trajectory_writer_thread, rec);
+	return rec;
+}
+
+// Record the positions of every object in the world, call this once per frame.
+// This only copies the positions, returns 1 if the frame was recorded, 0 if it was dropped because the writer is behind.
+int trajectory_recorder_record(TrajectoryRecorder* rec, World* w) {
+	int frame = rec->frames++;
+	pthread_mutex_lock(&rec->lock);
+	int full = rec->queued == rec->slot_count;
+	pthread_mutex_unlock(&rec->lock);
+	if (full) {
+		rec->dropped_frames++;
+		return 0;
+	}
+
+	// Only the simulation thread adds frames, so the head slot stays free while filling it
+	TrajectorySlot* slot = &rec->slots[rec->head];
+	if (w->size > slot->capacity) {
+		slot->capacity = w->size;
+		slot->x = realloc(slot->x, w->size * sizeof(float));
+		slot->y = realloc(slot->y, w->size * sizeof(float));
+		slot->ids = realloc(slot->ids, w->size * sizeof(int));
+	}
+	for (int i = 0; i < w->size; i++) {
+		slot->x[i] = w->objects[i].position.x;
+		slot->y[i] = w->objects[i].position.y;
+		slot->ids[i] = w->ids ? w->ids[i] : i;
+	}
+	slot->count = w->size;
+	slot->frame = frame;
+	slot->reorders = w->reorders;
+
+	pthread_mutex_lock(&rec->lock);
+	rec->head = (rec->head + 1) % rec->slot_count;
+	rec->queued++;
+	pthread_cond_signal(&rec->work_ready);
+	pthread_mutex_unlock(&rec->lock);
+	return 1;
+}
+
+// The size of the recording so far, not counting frames still waiting to be written.
+size_t trajectory_recorder_bytes(TrajectoryRecorder* rec) {
+	pthread_mutex_lock(&rec->lock);
+	size_t bytes = rec->bytes_written;
+	pthread_mutex_unlock(&rec->lock);
+	return bytes;
+}
+
+// 1 if writing to the file failed, frames recorded after that are lost.
+int trajectory_recorder_failed(TrajectoryRecorder* rec) {
+	pthread_mutex_lock(&rec->lock);
+	int failed = rec->write_failed;
+	pthread_mutex_unlock(&rec->lock);
+	return failed;
+}
+
+// Write out every frame still waiting, close the file and free the recorder.
+// Returns 1 if the whole recording was written, 0 if any of it failed to write.
+int free_trajectory_recorder(TrajectoryRecorder* rec) {
+	pthread_mutex_lock(&rec->lock);
+	rec->quit = 1;
+	pthread_cond_signal(&rec->work_ready);
+	pthread_mutex_unlock(&rec->lock);
+	pthread_join(rec->thread, 0);
+
+	// Closing writes out whatever is still buffered, which can fail too
+	int written = !rec->write_failed;
+	if (fclose(rec->file) != 0) written = 0;
+	pthread_mutex_destroy(&rec->lock);
+	pthread_cond_destroy(&rec->work_ready);
+	for (int i = 0; i < rec->slot_count; i++) {
+		free(rec->slots[i].x);
+		free(rec->slots[i].y);
+		free(rec->slots[i].ids);
+	}
+	free(rec->slots);
+	free(rec->last_x);
+	free(rec->last_y);
+	free(rec->before_x);
+	free(rec->before_y);
+	free(rec->buffer);
+	free(rec);
+	return written;
+}
+
+/////////////
+// Reading //
+/////////////
+
+typedef struct TrajectoryReader {
+	FILE* file;
+	float precision;
+	int keyframe_interval;
+
+	// Where every keyframe starts in the file, and it's frame number, found when opening the file.
+	long* keyframe_offsets;
+	int* keyframe_frames;
+	int keyframe_count;
+
+	// The frame last decoded, x, y and ids have .count entries.
+	int frame;
+	int count;
+	float* x;
+	float* y;
+	int* ids;
+
+	// Decoding state
+	int64_t* last_x;
+	int64_t* last_y;
+	int64_t* before_x;
+	int64_t* before_y;
+	int capacity;
+	int history;
+	uint8_t* buffer;
+	size_t buffer_capacity;
+} TrajectoryReader;
+
+void trajectory_reader_close(TrajectoryReader* reader) {
+	if (reader->file) fclose(reader->file);
+	free(reader->keyframe_offsets);
+	free(reader->keyframe_frames);
+	free(reader->x);
+	free(reader->y);
+	free(reader->ids);
+	free(reader->last_x);
+	free(reader->last_y);
+	free(reader->before_x);
+	free(reader->before_y);
+	free(reader->buffer);
+	memset(reader, 0, sizeof(TrajectoryReader));
+}
+
+// Open a recording, this skips through the frame headers to find the keyframes, without decoding anything.
+// Returns 1 if sucessfull, 0 if the file can't be read or isn't a recording. Call trajectory_reader_close when done.
+int trajectory_reader_open(const char* path, TrajectoryReader* reader) {
+	memset(reader, 0, sizeof(TrajectoryReader));
+	reader->frame = -1;
+	reader->file = fopen(path, "rb");
+	if (!reader->file) return 0;
+
+	TrajectoryHeader header;
+	if (fread(&header, sizeof(header), 1, reader->file) != 1
+		|| memcmp(header.magic, TRAJECTORY_MAGIC, 8) != 0
+		|| header.version != TRAJECTORY_VERSION) {
+		trajectory_reader_close(reader);
+		return 0;
+	}
+	reader->precision = header.precision;
+	reader->keyframe_interval = header.keyframe_interval;
+
+	int capacity = 0;
+	while (1) {
+		long offset = ftell(reader->file);
+		TrajectoryFrameHeader frame;
+		if (fread(&frame, sizeof(frame), 1, reader->file) != 1) break;
+		if (frame.type == TRAJECTORY_KEYFRAME) {
+			if (reader->keyframe_count >= capacity) {
+				capacity = capacity ? capacity * 2 : 64;
+				reader->keyframe_offsets = realloc(reader->keyframe_offsets, capacity * sizeof(long));
+				reader->keyframe_frames = realloc(reader->keyframe_frames, capacity * sizeof(int));
+			}
+			reader->keyframe_offsets[reader->keyframe_count] = offset;
+			reader->keyframe_frames[reader->keyframe_count] = frame.frame;
+			reader->keyframe_count++;
+		}
+		if (fseek(reader->file, frame.payload_size, SEEK_CUR) != 0) break;
+	}
+
+	// Start at the first frame
+	if (reader->keyframe_count > 0) fseek(reader->file, reader->keyframe_offsets[0], SEEK_SET);
+	return 1;
+}
+
+// Decode the next frame into reader->x, reader->y and reader->ids, and set reader->frame to it's number.
+// Returns 1 if sucessfull, 0 at the end of the recording (or if it is damaged).
+int trajectory_reader_next(TrajectoryReader* reader) {
+	TrajectoryFrameHeader frame;
+	if (fread(&frame, sizeof(frame), 1, reader->file) != 1) return 0;
+	if (frame.type != TRAJECTORY_KEYFRAME && (frame.type != TRAJECTORY_DELTA || reader->history == 0 || frame.count != (uint32_t)reader->count)) return 0;
+
+	if (frame.payload_size > reader->buffer_capacity) {
+		reader->buffer_capacity = frame.payload_size;
+		reader->buffer = realloc(reader->buffer, frame.payload_size);
+	}
+	if (fread(reader->buffer, 1, frame.payload_size, reader->file) != frame.payload_size) return 0;
+
+	int n = frame.count;
+	if (n > reader->capacity) {
+		reader->capacity = n;
+		reader->x = realloc(reader->x, n * sizeof(float));
+		reader->y = realloc(reader->y, n * sizeof(float));
+		reader->ids = realloc(reader->ids, n * sizeof(int));
+		reader->last_x = realloc(reader->last_x, n * sizeof(int64_t));
+		reader->last_y = realloc(reader->last_y, n * sizeof(int64_t));
+		reader->before_x = realloc(reader->before_x, n * sizeof(int64_t));
+		reader->before_y = realloc(reader->before_y, n * sizeof(int64_t));
+	}
+
+	const uint8_t* in = reader->buffer;
+	const uint8_t* end = in + frame.payload_size;
+	int64_t value;
+	int length;
+	if (frame.type == TRAJECTORY_KEYFRAME) {
+		int64_t previous = 0;
+		for (int i = 0; i < n; i++) {
+			if (!(length = trajectory_get_varint(in, end, &value))) return 0;
+			in += length;
+			previous += value;
+			reader->ids[i] = (int)previous;
+		}
+		previous = 0;
+		for (int i = 0; i < n; i++) {
+			if (!(length = trajectory_get_varint(in, end, &value))) return 0;
+			in += length;
+			previous += value;
+			reader->last_x[i] = previous;
+		}
+		previous = 0;
+		for (int i = 0; i < n; i++) {
+			if (!(length = trajectory_get_varint(in, end, &value))) return 0;
+			in += length;
+			previous += value;
+			reader->last_y[i] = previous;
+		}
+		reader->history = 1;
+	} else {
+		for (int i = 0; i < n; i++) {
+			int64_t dx, dy;
+			if (!(length = trajectory_get_varint(in, end, &dx))) return 0;
+			in += length;
+			if (!(length = trajectory_get_varint(in, end, &dy))) return 0;
+			in += length;
+			int64_t qx = trajectory_predict(reader->last_x[i], reader->before_x[i], reader->history) + dx;
+			int64_t qy = trajectory_predict(reader->last_y[i], reader->before_y[i], reader->history) + dy;
+			reader->before_x[i] = reader->last_x[i];
+			reader->before_y[i] = reader->last_y[i];
+			reader->last_x[i] = qx;
+			reader->last_y[i] = qy;
+		}
+		reader->history++;
+	}
+
+	for (int i = 0; i < n; i++) {
+		reader->x[i] = reader->last_x[i] * reader->precision;
+		reader->y[i] = reader->last_y[i] * reader->precision;
+	}
+	reader->count = n;
+	reader->frame = frame.frame;
+	return 1;
+}
+
+// Go to a frame, decoding from the keyframe before it. If the frame was dropped, this stops at the first frame after it.
+// Returns 1 if sucessfull, 0 if the frame is past the end of the recording.
+int trajectory_reader_seek(TrajectoryReader* reader, int frame) {
+	if (reader->keyframe_count == 0) return 0;
+	// The last keyframe at or before the frame
+	int low = 0, high = reader->keyframe_count - 1;
+	while (low < high) {
+		int middle = (low + high + 1) / 2;
+		if (reader->keyframe_frames[middle] <= frame) low = middle;
+		else high = middle - 1;
+	}
+	fseek(reader->file, reader->keyframe_offsets[low], SEEK_SET);
+	reader->history = 0;
+	do {
+		if (!trajectory_reader_next(reader)) return 0;
+	} while (reader->frame < frame);
+	return 1;
+}
+
+#endif
@@ -0,0 +1,395 @@
+// Saving and loading the state of a simulation, so it can be started from an already settled state.
+//
+// snapshot_save writes a World, and optionally the parameters of an AccessGrid and a DistanceConstraints store, to a file in a single write.
+// To load it, snapshot_open maps the file into memory, and snapshot_load_world and friends copy the arrays out in bulk, without
+// looking at every object. The arrays can also be used in place, see snapshot_objects.
+//
+// The file is just the arrays from memory, so it can only be loaded on a machine with the same byte order and struct layout,
+// snapshot_open checks for this and refuses to load anything else.
+//
+// Uses POSIX file IO and mmap.
+
+#ifndef HAS_PHYSICS_SNAPSHOT
+#define HAS_PHYSICS_SNAPSHOT 1
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "physics_optimized.h"
+#include "physics_constraints.h"
+
+#define SNAPSHOT_MAGIC "PHYSSNAP"
+// Increment this when changing the format, old files are rejected.
+#define SNAPSHOT_VERSION 1
+// Used to detect files written on a machine with a diffrent byte order
+#define SNAPSHOT_BYTE_ORDER 0x01020304
+// Every array in the file starts on a multiple of this
+#define SNAPSHOT_ALIGNMENT 16
+
+// The start of every snapshot file, the arrays follow at the given offsets from the start of the file.
+typedef struct SnapshotHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	uint32_t header_size;
+	uint32_t body_size;
+
+	// The World
+	int32_t size;
+	int32_t has_ids;
+	int32_t free_id;
+	int32_t id_count;
+	float sleep_threshold;
+	int32_t sleep_delay;
+	uint64_t objects_offset;
+	uint64_t ids_offset;
+	uint64_t indices_offset;
+	uint64_t generations_offset;
+
+	// The AccessGrid parameters, only the size and position, the grid is rebuilt when used
+	int32_t has_grid;
+	int32_t grid_x_size;
+	int32_t grid_y_size;
+	float grid_start_x;
+	float grid_start_y;
+	float grid_cellsize;
+
+	// The DistanceConstraints, lambda is not saved, since it is reset every timestep
+	int32_t has_constraints;
+	int32_t constraint_count;
+	float break_distance;
+	int32_t color_count;
+	uint64_t idx1_offset;
+	uint64_t idx2_offset;
+	uint64_t length_offset;
+	uint64_t compliance_offset;
+	uint64_t broken_offset;
+	uint64_t color_start_offset;
+
+	// Size of the whole file
+	uint64_t file_size;
+} SnapshotHeader;
+
+// An open snapshot file, mapped into memory
+typedef struct Snapshot {
+	void* data;
+	size_t length;
+	SnapshotHeader* header;
+} Snapshot;
+
+/////////////
+// Writing //
+/////////////
+
+// The pieces of a file being written, each array is written straight from where it is in memory.
+typedef struct SnapshotWriter {
+	struct iovec parts[32];
+	int part_count;
+	uint64_t offset;
+} SnapshotWriter;
+
+// Add an array to the file, returning it's offset, followed by padding up to SNAPSHOT_ALIGNMENT.
+uint64_t snapshot_writer_add(SnapshotWriter* writer, const void* data, size_t length) {
+	static const char padding[SNAPSHOT_ALIGNMENT] = {0};
+	uint64_t offset = writer->offset;
+	if (length == 0) return offset;
+	writer->parts[writer->part_count].iov_base = (void*)data;
+	writer->parts[writer->part_count].iov_len = length;
+	writer->part_count++;
+	writer->offset += length;
+
+	size_t extra = (SNAPSHOT_ALIGNMENT - writer->offset % SNAPSHOT_ALIGNMENT) % SNAPSHOT_ALIGNMENT;
+	if (extra) {
+		writer->parts[writer->part_count].iov_base = (void*)padding;
+		writer->parts[writer->part_count].iov_len = extra;
+		writer->part_count++;
+		writer->offset += extra;
+	}
+	return offset;
+}
+
+// Save a world to a file, grid and constraints can be null if there are none.
+// Everything is written with a single writev call (more only if the OS writes less than asked), so this is about as fast as the disk.
+// Returns 1 if sucessfull, 0 if the file could not be written.
+int snapshot_save(const char* path, World* w, AccessGrid* grid, DistanceConstraints* c) {
+	// The saved idx1/idx2 have to match the saved objects, even if the world was sorted since the last solve
+	if (c) distance_constraints_sync(w, c);
+
+	SnapshotHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, SNAPSHOT_MAGIC, 8);
+	header.version = SNAPSHOT_VERSION;
+	header.byte_order = SNAPSHOT_BYTE_ORDER;
+	header.header_size = sizeof(SnapshotHeader);
+	header.body_size = sizeof(Body);
+
+	SnapshotWriter writer = {.part_count = 0, .offset = 0};
+	snapshot_writer_add(&writer, &header, sizeof(header));
+
+	header.size = w->size;
+	header.has_ids = w->ids != 0;
+	header.free_id = w->free_id;
+	header.id_count = w->id_count;
+	header.sleep_threshold = w->sleep_threshold;
+	header.sleep_delay = w->sleep_delay;
+	header.objects_offset = snapshot_writer_add(&writer, w->objects, w->size * sizeof(Body));
+	if (w->ids) {
+		header.ids_offset = snapshot_writer_add(&writer, w->ids, w->size * sizeof(int));
+		// Removed ids are in .indices, as the free list
+		header.indices_offset = snapshot_writer_add(&writer, w->indices, w->id_count * sizeof(int));
+		header.generations_offset = snapshot_writer_add(&writer, w->generations, w->id_count * sizeof(int));
+	}
+
+	if (grid) {
+		header.has_grid = 1;
+		header.grid_x_size = grid->x_size;
+		header.grid_y_size = grid->y_size;
+		header.grid_start_x = grid->start_x;
+		header.grid_start_y = grid->start_y;
+		header.grid_cellsize = grid->cellsize;
+	}
+
+	if (c) {
+		header.has_constraints = 1;
+		header.constraint_count = c->size;
+		header.break_distance = c->break_distance;
+		header.color_count = c->color_start ? c->color_count : 0;
+		header.idx1_offset = snapshot_writer_add(&writer, c->idx1, c->size * sizeof(int));
+		header.idx2_offset = snapshot_writer_add(&writer, c->idx2, c->size * sizeof(int));
+		header.length_offset = snapshot_writer_add(&writer, c->length, c->size * sizeof(float));
+		header.compliance_offset = snapshot_writer_add(&writer, c->compliance, c->size * sizeof(float));
+		header.broken_offset = snapshot_writer_add(&writer, c->broken, c->size * sizeof(char));
+		if (c->color_start) header.color_start_offset = snapshot_writer_add(&writer, c->color_start, (c->color_count + 1) * sizeof(int));
+	}
+	header.file_size = writer.offset;
+
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) return 0;
+
+	// Write everything, picking up where the last call stopped if the OS didn't take all of it
+	struct iovec* parts = writer.parts;
+	int part_count = writer.part_count;
+	while (part_count > 0) {
+		ssize_t written = writev(fd, parts, part_count);
+		if (written < 0) {
+			close(fd);
+			return 0;
+		}
+		while (part_count > 0 && (size_t)written >= parts->iov_len) {
+			written -= parts->iov_len;
+			parts++;
+			part_count--;
+		}
+		if (part_count > 0) {
+			parts->iov_base = (char*)parts->iov_base + written;
+			parts->iov_len -= written;
+		}
+	}
+	return close(fd) == 0;
+}
+
+/////////////
+// Reading //
+/////////////
+
+// Check that an array is inside of the file, and aligned like snapshot_save writes them
+int snapshot_range_valid(Snapshot* snap, uint64_t offset, uint64_t length) {
+	return offset % SNAPSHOT_ALIGNMENT == 0 && offset <= snap->length && length <= snap->length - offset;
+}
+
+// Get a pointer to an array in the file
+void* snapshot_array(Snapshot* snap, uint64_t offset) {
+	return (char*)snap->data + offset;
+}
+
+// Check that the id tables describe a possible world: every object has a diffrent id that maps back to it,
+// and every other id is in the list of unused ids, without loops. New ids are only made once that list is empty,
+// so this also keeps .id_count within the capacity of the world.
+int snapshot_ids_valid(Snapshot* snap) {
+	SnapshotHeader* h = snap->header;
+	if (h->id_count < h->size) return 0;
+	const int* ids = snapshot_array(snap, h->ids_offset);
+	const int* indices = snapshot_array(snap, h->indices_offset);
+	for (int i = 0; i < h->size; i++) {
+		if (ids[i] < 0 || ids[i] >= h->id_count || indices[ids[i]] != i) return 0;
+	}
+
+	// 1 for ids in use, 2 for ids in the unused list
+	char* seen = calloc(h->id_count > 0 ? h->id_count : 1, 1);
+	for (int i = 0; i < h->size; i++) seen[ids[i]] = 1;
+	int valid = 1;
+	int unused = 0;
+	int id = h->free_id;
+	while (id != -1) {
+		if (id < 0 || id >= h->id_count || seen[id]) {
+			valid = 0;
+			break;
+		}
+		seen[id] = 2;
+		unused++;
+		id = indices[id];
+	}
+	free(seen);
+	return valid && h->size + unused == h->id_count;
+}
+
+// Check that every constraint refers to objects in the world, and the colors cover the constraints in order.
+int snapshot_constraints_valid(Snapshot* snap) {
+	SnapshotHeader* h = snap->header;
+	const int* idx1 = snapshot_array(snap, h->idx1_offset);
+	const int* idx2 = snapshot_array(snap, h->idx2_offset);
+	for (int i = 0; i < h->constraint_count; i++) {
+		if (idx1[i] < 0 || idx1[i] >= h->size || idx2[i] < 0 || idx2[i] >= h->size) return 0;
+	}
+	if (h->color_count > 0) {
+		if (h->color_count > h->constraint_count) return 0;
+		const int* color_start = snapshot_array(snap, h->color_start_offset);
+		if (color_start[0] != 0 || color_start[h->color_count] != h->constraint_count) return 0;
+		for (int k = 0; k < h->color_count; k++) {
+			if (color_start[k] > color_start[k + 1]) return 0;
+		}
+	}
+	return 1;
+}
+
+// Open a snapshot file, mapping it into memory. Returns 1 if sucessfull, 0 if the file can't be read, or isn't a valid snapshot
+// from this version of the engine on this kind of machine. Call snapshot_close when done with it.
+// Every array, id and index is checked here, so the load functions can trust them, even if the file was damaged.
+int snapshot_open(const char* path, Snapshot* snap) {
+	snap->data = 0;
+	snap->length = 0;
+	snap->header = 0;
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) return 0;
+	struct stat info;
+	if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(SnapshotHeader)) {
+		close(fd);
+		return 0;
+	}
+	void* data = mmap(0, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	// The mapping stays valid after closing the file
+	close(fd);
+	if (data == MAP_FAILED) return 0;
+	snap->data = data;
+	snap->length = info.st_size;
+	snap->header = data;
+
+	SnapshotHeader* h = snap->header;
+	int valid = memcmp(h->magic, SNAPSHOT_MAGIC, 8) == 0
+		&& h->version == SNAPSHOT_VERSION
+		&& h->byte_order == SNAPSHOT_BYTE_ORDER
+		&& h->header_size == sizeof(SnapshotHeader)
+		&& h->body_size == sizeof(Body)
+		&& h->file_size == snap->length
+		&& h->size >= 0 && h->id_count >= 0 && h->constraint_count >= 0 && h->color_count >= 0
+		&& snapshot_range_valid(snap, h->objects_offset, (uint64_t)h->size * sizeof(Body));
+	if (valid && h->has_ids) {
+		valid = snapshot_range_valid(snap, h->ids_offset, (uint64_t)h->size * sizeof(int))
+			&& snapshot_range_valid(snap, h->indices_offset, (uint64_t)h->id_count * sizeof(int))
+			&& snapshot_range_valid(snap, h->generations_offset, (uint64_t)h->id_count * sizeof(int))
+			&& snapshot_ids_valid(snap);
+	}
+	if (valid && h->has_grid) {
+		// Small enough that the cell count fits in an int
+		valid = h->grid_x_size > 0 && h->grid_y_size > 0 && (int64_t)h->grid_x_size * h->grid_y_size < (1 << 28)
+			&& h->grid_cellsize > 0 && isfinite(h->grid_cellsize) && isfinite(h->grid_start_x) && isfinite(h->grid_start_y);
+	}
+	if (valid && h->has_constraints) {
+		uint64_t count = h->constraint_count;
+		valid = snapshot_range_valid(snap, h->idx1_offset, count * sizeof(int))
+			&& snapshot_range_valid(snap, h->idx2_offset, count * sizeof(int))
+			&& snapshot_range_valid(snap, h->length_offset, count * sizeof(float))
+			&& snapshot_range_valid(snap, h->compliance_offset, count * sizeof(float))
+			&& snapshot_range_valid(snap, h->broken_offset, count * sizeof(char))
+			&& (h->color_count == 0 || snapshot_range_valid(snap, h->color_start_offset, (uint64_t)(h->color_count + 1) * sizeof(int)))
+			&& snapshot_constraints_valid(snap);
+	}
+	if (!valid) {
+		munmap(data, snap->length);
+		snap->data = 0;
+		snap->header = 0;
+		return 0;
+	}
+	return 1;
+}
+
+void snapshot_close(Snapshot* snap) {
+	if (snap->data) munmap(snap->data, snap->length);
+	snap->data = 0;
+	snap->length = 0;
+	snap->header = 0;
+}
+
+// The objects in the file, read only, and only valid until snapshot_close.
+// Use this to look at a snapshot without loading it.
+const Body* snapshot_objects(Snapshot* snap) {
+	return snapshot_array(snap, snap->header->objects_offset);
+}
+
+// Create a world from a snapshot, with the objects, ids and sleep settings as they were when it was saved.
+// The arrays are copied in one go, call world_cleanup on the world when done with it as usual.
+World snapshot_load_world(Snapshot* snap) {
+	SnapshotHeader* h = snap->header;
+	int capacity = h->has_ids && h->id_count > h->size ? h->id_count : h->size;
+	World w = world_with_capacity(capacity > 16 ? capacity : 16);
+	memcpy(w.objects, snapshot_array(snap, h->objects_offset), h->size * sizeof(Body));
+	w.size = h->size;
+	w.sleep_threshold = h->sleep_threshold;
+	w.sleep_delay = h->sleep_delay;
+
+	if (h->has_ids) {
+		memcpy(w.ids, snapshot_array(snap, h->ids_offset), h->size * sizeof(int));
+		memcpy(w.indices, snapshot_array(snap, h->indices_offset), h->id_count * sizeof(int));
+		memcpy(w.generations, snapshot_array(snap, h->generations_offset), h->id_count * sizeof(int));
+		w.free_id = h->free_id;
+		w.id_count = h->id_count;
+	} else {
+		// The world was never reordered, so every id is the index
+		for (int i = 0; i < w.size; i++) world_assign_id(&w, i);
+	}
+	return w;
+}
+
+// Create an empty AccessGrid with the same size and position as the one saved, returns 0 if no grid was saved.
+int snapshot_load_grid(Snapshot* snap, AccessGrid* grid) {
+	SnapshotHeader* h = snap->header;
+	if (!h->has_grid) return 0;
+	*grid = new_access_grid(h->grid_x_size, h->grid_y_size, h->grid_start_x, h->grid_start_y, h->grid_cellsize);
+	return 1;
+}
+
+// Load the distance constraints saved with the world, including their coloring, returns 0 if none were saved.
+// w is the world loaded from the same snapshot, which the constraints get handles to their objects from.
+int snapshot_load_constraints(Snapshot* snap, World* w, DistanceConstraints* c) {
+	SnapshotHeader* h = snap->header;
+	if (!h->has_constraints) return 0;
+	int count = h->constraint_count;
+	*c = distance_constraints_with_capacity(count);
+	memcpy(c->idx1, snapshot_array(snap, h->idx1_offset), count * sizeof(int));
+	memcpy(c->idx2, snapshot_array(snap, h->idx2_offset), count * sizeof(int));
+	memcpy(c->length, snapshot_array(snap, h->length_offset), count * sizeof(float));
+	memcpy(c->compliance, snapshot_array(snap, h->compliance_offset), count * sizeof(float));
+	memcpy(c->broken, snapshot_array(snap, h->broken_offset), count * sizeof(char));
+	memset(c->lambda, 0, count * sizeof(float));
+	for (int i = 0; i < count; i++) {
+		c->body1[i] = world_handle(w, c->idx1[i]);
+		c->body2[i] = world_handle(w, c->idx2[i]);
+	}
+	c->size = count;
+	c->world_reorders = w->reorders;
+	c->break_distance = h->break_distance;
+	if (h->color_count > 0) {
+		c->color_count = h->color_count;
+		c->color_start = malloc((h->color_count + 1) * sizeof(int));
+		memcpy(c->color_start, snapshot_array(snap, h->color_start_offset), (h->color_count + 1) * sizeof(int));
+	}
+	return 1;
+}
+
+#endif
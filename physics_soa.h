@@ -0,0 +1,183 @@
+// A structure of arrays version of the World from physics.h, for very large simulations.
+//
+// physics.h stores every body as one struct, so integration has to walk over interleaved records.
+// SoaWorld stores every property in its own aligned array instead, which lets the integration step
+// be done with SIMD instructions, handling 8 (AVX) or 4 (SSE) bodies at once.
+//
+// To use it, create the world with soa_world_with_capacity, add objects with soa_world_spawn, and call
+// soa_world_integrate every timestep. soa_world_integrate does the Verlet update, gravity and resets the
+// acceleration in a single pass, so do not call anything else to apply gravity.
+//
+// Compile with -mavx (or -march=native) to get the AVX kernel, otherwise SSE or plain C is used.
+
+#ifndef HAS_PHYSICS_SOA
+#define HAS_PHYSICS_SOA 1
+
+#include <stdlib.h>
+#include <string.h>
+#include "physics.h"
+
+#if defined(__AVX__) || defined(__SSE__)
+#include <immintrin.h>
+#endif
+
+// All arrays are aligned to this many bytes, enough for AVX loads and stores.
+#define SOA_ALIGNMENT 32
+// The capacity is rounded up to a multiple of this, so the vector loop never has to handle a partial register.
+#define SOA_LANES 8
+
+typedef struct SoaWorld {
+	// Each of these is a pointer to .capacity floats, aligned to SOA_ALIGNMENT.
+	float* x;
+	float* y;
+	float* old_x;
+	float* old_y;
+	float* acc_x;
+	float* acc_y;
+	float* radius;
+	// How many objects are in the world at the given moment
+	int size;
+	// The total amount that can be stored at a given time.
+	int capacity;
+} SoaWorld;
+
+// Allocate a empty world with a capacity to hold up to capacity objects
+// All of the arrays are stored in a single allocation, call soa_world_cleanup before discarding the SoaWorld.
+SoaWorld soa_world_with_capacity(int capacity) {
+	// Round up, to keep every array aligned and the vector loop simple
+	int stride = (capacity + SOA_LANES - 1) / SOA_LANES * SOA_LANES;
+	float* block = aligned_alloc(SOA_ALIGNMENT, 7 * stride * sizeof(float));
+	SoaWorld w = {
+		.x = block,
+		.y = block + stride,
+		.old_x = block + 2 * stride,
+		.old_y = block + 3 * stride,
+		.acc_x = block + 4 * stride,
+		.acc_y = block + 5 * stride,
+		.radius = block + 6 * stride,
+		.size = 0,
+		.capacity = stride
+	};
+	// Zero everything, including the padding, so the vector loop never reads garbage
+	if (block) memset(block, 0, 7 * stride * sizeof(float));
+	return w;
+}
+
+// Frees the arrays of a world, call before discarding it.
+void soa_world_cleanup(SoaWorld* w) {
+	// .x is the start of the single allocation.
+	free(w->x);
+	w->x = w->y = w->old_x = w->old_y = w->acc_x = w->acc_y = w->radius = 0;
+	w->size = 0;
+	w->capacity = 0;
+}
+
+// Create an object with given position and radius in the world, with 0 acceleration and 0 velocity.
+// Returns 1 if sucessful, 0 if the world is full.
+int soa_world_spawn(SoaWorld* w, float x, float y, float r) {
+	if (w->size >= w->capacity) return 0;
+	int i = w->size++;
+	w->x[i] = w->old_x[i] = x;
+	w->y[i] = w->old_y[i] = y;
+	w->acc_x[i] = w->acc_y[i] = 0;
+	w->radius[i] = r;
+	return 1;
+}
+
+// Copy all the objects of a normal World into a SoaWorld, replacing it's contents.
+// Objects past the capacity of the SoaWorld are ignored, returns the number of objects copied.
+int soa_world_load(SoaWorld* soa, World* w) {
+	int count = w->size < soa->capacity ? w->size : soa->capacity;
+	for (int i = 0; i < count; i++) {
+		Body* b = &w->objects[i];
+		soa->x[i] = b->position.x;
+		soa->y[i] = b->position.y;
+		soa->old_x[i] = b->position_old.x;
+		soa->old_y[i] = b->position_old.y;
+		soa->acc_x[i] = b->acceleration.x;
+		soa->acc_y[i] = b->acceleration.y;
+		soa->radius[i] = b->radius;
+	}
+	soa->size = count;
+	return count;
+}
+
+// Copy the state of a SoaWorld back into the first objects of a normal World, for example to use world_optimized_collide on it.
+// The World must already contain at least soa->size objects.
+void soa_world_store(SoaWorld* soa, World* w) {
+	for (int i = 0; i < soa->size && i < w->size; i++) {
+		Body* b = &w->objects[i];
+		b->position.x = soa->x[i];
+		b->position.y = soa->y[i];
+		b->position_old.x = soa->old_x[i];
+		b->position_old.y = soa->old_y[i];
+		b->acceleration.x = soa->acc_x[i];
+		b->acceleration.y = soa->acc_y[i];
+		b->radius = soa->radius[i];
+	}
+}
+
+// Verlet integration, gravity and acceleration reset for objects start up to end.
+// start has to be a multiple of SOA_LANES, and end is rounded up to one, so the objects after end up to that are also integrated.
+void soa_world_integrate_range(SoaWorld* w, int start, int end, float dt, float g) {
+	float dt2 = dt * dt;
+	// The arrays are padded to a multiple of SOA_LANES, so it is safe to run over the end
+	int count = (end + SOA_LANES - 1) / SOA_LANES * SOA_LANES;
+	int i = start;
+#if defined(__AVX__)
+	__m256 vdt2 = _mm256_set1_ps(dt2);
+	__m256 vg = _mm256_set1_ps(g);
+	__m256 zero = _mm256_setzero_ps();
+	for (; i < count; i += 8) {
+		__m256 x = _mm256_load_ps(w->x + i);
+		__m256 y = _mm256_load_ps(w->y + i);
+		__m256 vx = _mm256_sub_ps(x, _mm256_load_ps(w->old_x + i));
+		__m256 vy = _mm256_sub_ps(y, _mm256_load_ps(w->old_y + i));
+		__m256 ax = _mm256_load_ps(w->acc_x + i);
+		__m256 ay = _mm256_sub_ps(_mm256_load_ps(w->acc_y + i), vg);
+		_mm256_store_ps(w->old_x + i, x);
+		_mm256_store_ps(w->old_y + i, y);
+		_mm256_store_ps(w->x + i, _mm256_add_ps(x, _mm256_add_ps(vx, _mm256_mul_ps(ax, vdt2))));
+		_mm256_store_ps(w->y + i, _mm256_add_ps(y, _mm256_add_ps(vy, _mm256_mul_ps(ay, vdt2))));
+		_mm256_store_ps(w->acc_x + i, zero);
+		_mm256_store_ps(w->acc_y + i, zero);
+	}
+#elif defined(__SSE__)
+	__m128 vdt2 = _mm_set1_ps(dt2);
+	__m128 vg = _mm_set1_ps(g);
+	__m128 zero = _mm_setzero_ps();
+	for (; i < count; i += 4) {
+		__m128 x = _mm_load_ps(w->x + i);
+		__m128 y = _mm_load_ps(w->y + i);
+		__m128 vx = _mm_sub_ps(x, _mm_load_ps(w->old_x + i));
+		__m128 vy = _mm_sub_ps(y, _mm_load_ps(w->old_y + i));
+		__m128 ax = _mm_load_ps(w->acc_x + i);
+		__m128 ay = _mm_sub_ps(_mm_load_ps(w->acc_y + i), vg);
+		_mm_store_ps(w->old_x + i, x);
+		_mm_store_ps(w->old_y + i, y);
+		_mm_store_ps(w->x + i, _mm_add_ps(x, _mm_add_ps(vx, _mm_mul_ps(ax, vdt2))));
+		_mm_store_ps(w->y + i, _mm_add_ps(y, _mm_add_ps(vy, _mm_mul_ps(ay, vdt2))));
+		_mm_store_ps(w->acc_x + i, zero);
+		_mm_store_ps(w->acc_y + i, zero);
+	}
+#endif
+	// Plain C fallback, also written so the compiler can vectorize it on other architectures
+	for (; i < count; i++) {
+		float vx = w->x[i] - w->old_x[i];
+		float vy = w->y[i] - w->old_y[i];
+		w->old_x[i] = w->x[i];
+		w->old_y[i] = w->y[i];
+		w->x[i] += vx + w->acc_x[i] * dt2;
+		w->y[i] += vy + (w->acc_y[i] - g) * dt2;
+		w->acc_x[i] = 0;
+		w->acc_y[i] = 0;
+	}
+}
+
+// Verlet integration, gravity and acceleration reset for the whole world in one pass, call this every timestep.
+// This has the same effect as calling world_apply_gravity followed by world_update_positions on a normal World.
+void soa_world_integrate(SoaWorld* w, float dt, float g) {
+	soa_world_integrate_range(w, 0, w->size, dt, g);
+}
+
+#endif
@@ -0,0 +1,428 @@
+// Multithreaded versions of the solvers in physics_optimized.h
+//
+// Create a WorkerPool once with new_worker_pool, and pass it to world_threaded_collide instead of calling world_optimized_collide,
+// or to distance_constraints_threaded_solve to solve constraints from physics_constraints.h.
+// For results that don't depend on the number of threads, use the JacobiCollide solver.
+// Remember to call free_worker_pool when done with it.
+//
+// Has to be compiled with -lpthread under gcc.
+
+#ifndef HAS_PHYSICS_THREADED
+#define HAS_PHYSICS_THREADED 1
+
+#include <stdlib.h>
+#include <pthread.h>
+#include "physics_optimized.h"
+#include "physics_constraints.h"
+
+/////////////////
+// Worker pool //
+/////////////////
+
+// A function run by the worker pool, task is a number from 0 to the task count passed to worker_pool_run.
+typedef void (*WorkerTask)(void* data, int task);
+
+// A set of threads that wait around for work, to avoid the cost of creating threads every timestep.
+// The thread calling worker_pool_run also does work, so a pool with a thread_count of 1 creates no threads at all.
+typedef struct WorkerPool {
+	int thread_count;
+	pthread_t* threads;
+
+	pthread_mutex_t lock;
+	pthread_cond_t work_ready;
+	pthread_cond_t work_done;
+
+	// The current batch of work, protected by .lock
+	WorkerTask task;
+	void* data;
+	int task_count;
+	int next_task;
+	int tasks_done;
+	// Incremented for every batch, so the workers can tell new work apart from work they have already seen.
+	int generation;
+	int quit;
+} WorkerPool;
+
+// Grab tasks until there are none left, the pool must be locked when calling this, and will be locked when it returns.
+void worker_pool_work(WorkerPool* pool) {
+	while (pool->next_task < pool->task_count) {
+		int task = pool->next_task++;
+		pthread_mutex_unlock(&pool->lock);
+		pool->task(pool->data, task);
+		pthread_mutex_lock(&pool->lock);
+		pool->tasks_done++;
+		if (pool->tasks_done == pool->task_count) pthread_cond_broadcast(&pool->work_done);
+	}
+}
+
+void* worker_pool_thread(void* arg) {
+	WorkerPool* pool = arg;
+	int seen = 0;
+	pthread_mutex_lock(&pool->lock);
+	while (1) {
+		while (!pool->quit && pool->generation == seen)
+			pthread_cond_wait(&pool->work_ready, &pool->lock);
+		if (pool->quit) break;
+		seen = pool->generation;
+		worker_pool_work(pool);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return 0;
+}
+
+// Create a pool using thread_count threads in total, including the thread calling worker_pool_run.
+// The pool is heap allocated, call free_worker_pool when done with it.
+WorkerPool* new_worker_pool(int thread_count) {
+	if (thread_count < 1) thread_count = 1;
+	WorkerPool* pool = malloc(sizeof(WorkerPool));
+	pool->thread_count = thread_count;
+	pool->threads = malloc(thread_count * sizeof(pthread_t));
+	pthread_mutex_init(&pool->lock, 0);
+	pthread_cond_init(&pool->work_ready, 0);
+	pthread_cond_init(&pool->work_done, 0);
+	pool->task = 0;
+	pool->data = 0;
+	pool->task_count = 0;
+	pool->next_task = 0;
+	pool->tasks_done = 0;
+	pool->generation = 0;
+	pool->quit = 0;
+	for (int i = 0; i < thread_count - 1; i++) {
+		pthread_create(&pool->threads[i], 0, worker_pool_thread, pool);
+	}
+	return pool;
+}
+
+// Stop all the threads and free the pool.
+void free_worker_pool(WorkerPool* pool) {
+	pthread_mutex_lock(&pool->lock);
+	pool->quit = 1;
+	pthread_cond_broadcast(&pool->work_ready);
+	pthread_mutex_unlock(&pool->lock);
+	for (int i = 0; i < pool->thread_count - 1; i++) {
+		pthread_join(pool->threads[i], 0);
+	}
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->work_ready);
+	pthread_cond_destroy(&pool->work_done);
+	free(pool->threads);
+	free(pool);
+}
+
+// Run task(data, 0) through task(data, task_count - 1) spread over all the threads in the pool, returns once all of them are done.
+// The order tasks are run in is not defined, so tasks must not depend on each other.
+void worker_pool_run(WorkerPool* pool, WorkerTask task, void* data, int task_count) {
+	pthread_mutex_lock(&pool->lock);
+	pool->task = task;
+	pool->data = data;
+	pool->task_count = task_count;
+	pool->next_task = 0;
+	pool->tasks_done = 0;
+	pool->generation++;
+	pthread_cond_broadcast(&pool->work_ready);
+
+	worker_pool_work(pool);
+	while (pool->tasks_done < pool->task_count)
+		pthread_cond_wait(&pool->work_done, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+//////////////////////////////
+// Threaded physics solver //
+//////////////////////////////
+
+// How many stripes each thread gets per pass, more stripes spread the work more evenly, but add overhead.
+#define STRIPES_PER_THREAD 4
+
+typedef struct StripeJob {
+	World* w;
+	AccessGrid* grid;
+	// Width of each stripe in grid columns
+	int stripe_width;
+	// 0 for the even stripes, 1 for the odd ones.
+	int parity;
+} StripeJob;
+
+void collide_stripe(void* data, int task) {
+	StripeJob* job = data;
+	int start = (task * 2 + job->parity) * job->stripe_width;
+	int end = start + job->stripe_width;
+	if (end > job->grid->x_size) end = job->grid->x_size;
+	for (int x = start; x < end; x++)
+		for (int y = 0; y < job->grid->y_size; y++)
+			access_grid_collide_cell(job->w, job->grid, x, y);
+}
+
+// The multithreaded version of access_grid_collide, using the grid built by the last access_grid_populate call.
+//
+// Checking two objects moves both of them, so the grid is split into vertical stripes of columns.
+// All the even stripes are solved in parallel, then all the odd ones. Checking a cell only touches objects
+// up to grid->reach columns to the right, so stripes at least that wide never touch the same object.
+void access_grid_threaded_collide(World* w, AccessGrid* grid, WorkerPool* pool) {
+	int stripe_width = grid->x_size / (pool->thread_count * STRIPES_PER_THREAD * 2);
+	if (stripe_width < grid->reach) stripe_width = grid->reach;
+
+	int stripe_count = (grid->x_size + stripe_width - 1) / stripe_width;
+
+	StripeJob job = {.w = w, .grid = grid, .stripe_width = stripe_width, .parity = 0};
+	worker_pool_run(pool, collide_stripe, &job, (stripe_count + 1) / 2);
+	job.parity = 1;
+	worker_pool_run(pool, collide_stripe, &job, stripe_count / 2);
+}
+
+// A multithreaded version of world_optimized_collide, the grid and cell size work the same way.
+void world_threaded_collide(World* w, AccessGrid* grid, WorkerPool* pool) {
+	access_grid_populate(w, grid);
+	access_grid_threaded_collide(w, grid, pool);
+}
+
+// What to pass as StepSettings.collide_data with step_threaded_collide
+typedef struct ThreadedCollide {
+	AccessGrid* grid;
+	WorkerPool* pool;
+} ThreadedCollide;
+
+// world_threaded_collide for StepSettings.collide, set .collide_data to a ThreadedCollide.
+void step_threaded_collide(World* w, void* data) {
+	ThreadedCollide* collide = data;
+	world_threaded_collide(w, collide->grid, collide->pool);
+}
+
+// access_grid_threaded_collide for StepSettings.collide, using the grid as it is, for use with step_update_grid as the .broad_phase.
+void step_threaded_grid_collide(World* w, void* data) {
+	ThreadedCollide* collide = data;
+	access_grid_threaded_collide(w, collide->grid, collide->pool);
+}
+
+///////////////////////////////////
+// Threaded constraint solving   //
+///////////////////////////////////
+
+// How many constraints each task solves, tasks this big keep the overhead of the pool low.
+#define CONSTRAINTS_PER_TASK 1024
+
+typedef struct ConstraintJob {
+	World* w;
+	DistanceConstraints* c;
+	// The range of constraints in the color being solved
+	int start;
+	int end;
+} ConstraintJob;
+
+void solve_constraint_chunk(void* data, int task) {
+	ConstraintJob* job = data;
+	int start = job->start + task * CONSTRAINTS_PER_TASK;
+	int end = start + CONSTRAINTS_PER_TASK;
+	if (end > job->end) end = job->end;
+	distance_constraints_solve_range(job->w, job->c, start, end);
+}
+
+// Solve all the constraints in a store, one color at a time, with the constraints of each color split between the threads.
+// No two constraints of a color share an object, so there are no races. The constraints have to be colored with distance_constraints_color,
+// otherwise they are solved on the calling thread.
+void distance_constraints_threaded_solve(World* w, DistanceConstraints* c, WorkerPool* pool) {
+	distance_constraints_sync(w, c);
+	if (!c->color_start) {
+		distance_constraints_solve_range(w, c, 0, c->size);
+		return;
+	}
+	for (int color = 0; color < c->color_count; color++) {
+		ConstraintJob job = {.w = w, .c = c, .start = c->color_start[color], .end = c->color_start[color + 1]};
+		int tasks = (job.end - job.start + CONSTRAINTS_PER_TASK - 1) / CONSTRAINTS_PER_TASK;
+		worker_pool_run(pool, solve_constraint_chunk, &job, tasks);
+	}
+}
+
+////////////////////////////////////
+// Deterministic (Jacobi) solver  //
+////////////////////////////////////
+
+// How many grid columns each task gathers corrections for
+#define JACOBI_COLUMNS_PER_TASK 4
+// How many objects each task applies corrections to
+#define JACOBI_OBJECTS_PER_TASK 4096
+
+// The other collision solvers move objects as soon as a collision is found (Gauss-Seidel), so the result depends on the order
+// objects are checked in, and on how the work is split between threads. This solver first works out how far every object
+// should move, based only on the positions at the start of the iteration, then moves them all at once (Jacobi).
+// Every object only writes to it's own entry, and sums up it's collisions in the same order, so the result is bit for bit
+// the same no matter how many threads are used, or if there is a pool at all.
+//
+// Jacobi iterations converge slower than Gauss-Seidel ones, so this needs more collision iterations for the same rigidity.
+typedef struct JacobiCollide {
+	AccessGrid* grid;
+	// Can be null, to run on the calling thread.
+	WorkerPool* pool;
+	// How far each object should move, and if it should be woken up, for .capacity objects.
+	float* delta_x;
+	float* delta_y;
+	char* wake;
+	int capacity;
+	// The sum of corrections is scaled by this, lower than 1 is slower, but more stable in dense piles.
+	float relaxation;
+} JacobiCollide;
+
+JacobiCollide new_jacobi_collide(AccessGrid* grid, WorkerPool* pool) {
+	JacobiCollide jacobi = {
+		.grid = grid,
+		.pool = pool,
+		.delta_x = 0,
+		.delta_y = 0,
+		.wake = 0,
+		.capacity = 0,
+		.relaxation = 1
+	};
+	return jacobi;
+}
+
+void free_jacobi_collide(JacobiCollide* jacobi) {
+	free(jacobi->delta_x);
+	free(jacobi->delta_y);
+	free(jacobi->wake);
+	jacobi->delta_x = 0;
+	jacobi->delta_y = 0;
+	jacobi->wake = 0;
+	jacobi->capacity = 0;
+}
+
+typedef struct JacobiJob {
+	World* w;
+	JacobiCollide* jacobi;
+	float wake2;
+} JacobiJob;
+
+// Add up the corrections for one object, from every object in the surrounding cells, in a fixed order.
+// This follows world_collide_pair, including sleeping, but only reads other objects.
+void jacobi_gather_object(JacobiJob* job, int idx, int x, int y) {
+	World* w = job->w;
+	AccessGrid* grid = job->jacobi->grid;
+	Body* body = &w->objects[idx];
+	float sum_x = 0, sum_y = 0;
+	char wake = 0;
+
+	// Every pair is seen from both objects, only count it from the one with the lower index, so the stats match the other solvers
+	int pairs = 0;
+	int contacts = 0;
+	int reach = grid->reach;
+	for (int nx = x - reach; nx <= x + reach; nx++) {
+		if (nx < 0 || nx >= grid->x_size) continue;
+		for (int ny = y - reach; ny <= y + reach; ny++) {
+			if (ny < 0 || ny >= grid->y_size) continue;
+			int* others = access_grid_get(grid, nx, ny);
+			int length = access_grid_length(grid, nx, ny);
+			for (int e = 0; e < length; e++) {
+				int other_idx = others[e];
+				if (other_idx == idx) continue;
+				Body* other = &w->objects[other_idx];
+				if (physics_asleep(body) && physics_asleep(other)) continue;
+				int counted = other_idx > idx;
+				pairs += counted;
+
+				float mindistance = body->radius + other->radius;
+				float dx = body->position.x - other->position.x;
+				float dy = body->position.y - other->position.y;
+				float distance = sqrtf(dx * dx + dy * dy);
+				if (mindistance <= distance) continue;
+				contacts += counted;
+
+				float share = 0.5;
+				if (physics_asleep(body)) {
+					if (physics_speed2(other) > job->wake2) wake = 1;
+					else share = 0;
+				} else if (physics_asleep(other) && physics_speed2(body) <= job->wake2) {
+					share = 1;
+				}
+
+				// Both objects of a pair see the same distance and opposite directions, so their corrections match exactly.
+				float direction_x = 1, direction_y = 0;
+				if (distance > 0) {
+					direction_x = dx / distance;
+					direction_y = dy / distance;
+				} else if (idx < other_idx) {
+					direction_x = -1;
+				}
+				float delta = (mindistance - distance) * share;
+				sum_x += direction_x * delta;
+				sum_y += direction_y * delta;
+			}
+		}
+	}
+
+	PHYSICS_STAT(pairs_tested, pairs);
+	PHYSICS_STAT(contacts_resolved, contacts);
+	job->jacobi->delta_x[idx] = sum_x;
+	job->jacobi->delta_y[idx] = sum_y;
+	job->jacobi->wake[idx] = wake;
+}
+
+void jacobi_gather_task(void* data, int task) {
+	JacobiJob* job = data;
+	AccessGrid* grid = job->jacobi->grid;
+	int start = task * JACOBI_COLUMNS_PER_TASK;
+	int end = start + JACOBI_COLUMNS_PER_TASK;
+	if (end > grid->x_size) end = grid->x_size;
+	for (int x = start; x < end; x++) {
+		for (int y = 0; y < grid->y_size; y++) {
+			int* indecies = access_grid_get(grid, x, y);
+			int length = access_grid_length(grid, x, y);
+			for (int i = 0; i < length; i++) jacobi_gather_object(job, indecies[i], x, y);
+		}
+	}
+	PHYSICS_STAT(cells_visited, (end - start) * grid->y_size);
+}
+
+void jacobi_apply_task(void* data, int task) {
+	JacobiJob* job = data;
+	JacobiCollide* jacobi = job->jacobi;
+	Body* objects = job->w->objects;
+	int* object_cell = jacobi->grid->object_cell;
+	int start = task * JACOBI_OBJECTS_PER_TASK;
+	int end = start + JACOBI_OBJECTS_PER_TASK;
+	if (end > job->w->size) end = job->w->size;
+	float relaxation = jacobi->relaxation;
+	for (int i = start; i < end; i++) {
+		// Objects outside of the grid were never gathered
+		if (object_cell[i] < 0) continue;
+		objects[i].position.x += jacobi->delta_x[i] * relaxation;
+		objects[i].position.y += jacobi->delta_y[i] * relaxation;
+		if (jacobi->wake[i]) physics_wake(&objects[i]);
+	}
+}
+
+// Run a collision iteration with the Jacobi solver, using the grid built by the last access_grid_populate or access_grid_update call.
+void access_grid_jacobi_collide(World* w, JacobiCollide* jacobi) {
+	if (w->size > jacobi->capacity) {
+		free(jacobi->delta_x);
+		free(jacobi->delta_y);
+		free(jacobi->wake);
+		jacobi->capacity = w->size;
+		jacobi->delta_x = malloc(jacobi->capacity * sizeof(float));
+		jacobi->delta_y = malloc(jacobi->capacity * sizeof(float));
+		jacobi->wake = malloc(jacobi->capacity * sizeof(char));
+	}
+
+	float wake = w->sleep_threshold * SLEEP_WAKE_FACTOR;
+	JacobiJob job = {.w = w, .jacobi = jacobi, .wake2 = wake * wake};
+	int gather_tasks = (jacobi->grid->x_size + JACOBI_COLUMNS_PER_TASK - 1) / JACOBI_COLUMNS_PER_TASK;
+	int apply_tasks = (w->size + JACOBI_OBJECTS_PER_TASK - 1) / JACOBI_OBJECTS_PER_TASK;
+	if (jacobi->pool) {
+		worker_pool_run(jacobi->pool, jacobi_gather_task, &job, gather_tasks);
+		worker_pool_run(jacobi->pool, jacobi_apply_task, &job, apply_tasks);
+	} else {
+		for (int task = 0; task < gather_tasks; task++) jacobi_gather_task(&job, task);
+		for (int task = 0; task < apply_tasks; task++) jacobi_apply_task(&job, task);
+	}
+}
+
+// The Jacobi version of world_optimized_collide, this updates the grid then runs one iteration.
+void world_jacobi_collide(World* w, JacobiCollide* jacobi) {
+	access_grid_update(w, jacobi->grid);
+	access_grid_jacobi_collide(w, jacobi);
+}
+
+// access_grid_jacobi_collide for StepSettings.collide, set .collide_data to a JacobiCollide, and use step_update_grid with it's grid as the .broad_phase.
+void step_jacobi_collide(World* w, void* data) {
+	access_grid_jacobi_collide(w, data);
+}
+
+#endif
@@ -0,0 +1,325 @@
+// Drawing worlds without a window or a GPU, into an RGBA framebuffer in memory, for example to make videos of long simulations.
+//
+// The framebuffer is split into square tiles, and each object is put in a list (bin) for every tile it touches.
+// Every tile is then drawn on it's own, by the threads of a WorkerPool, since tiles don't overlap no locking is needed.
+// Objects in a tile are drawn in order, so the result is the same no matter how many threads there are.
+//
+// The view works like render.h's: centered on the origin, with pixels_per_unit setting the zoom, and the same colors as render_world.
+// Frames can be written as raw RGBA, or as Y4M video, which most video tools (like ffmpeg) can read.
+//
+// Has to be compiled with -lpthread under gcc.
+
+#ifndef HAS_RASTER
+#define HAS_RASTER 1
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include "physics.h"
+#include "physics_threaded.h"
+
+// Width and height of a tile in pixels
+#define RASTER_TILE_SIZE 64
+// Rows of the image converted to Y4M by each task
+#define RASTER_ROWS_PER_TASK 32
+
+// An object on screen, in pixels
+typedef struct RasterCircle {
+	float x;
+	float y;
+	float radius;
+	uint32_t color;
+} RasterCircle;
+
+typedef struct Rasterizer {
+	int width;
+	int height;
+	// .width * .height pixels, row by row, each 4 bytes: red, green, blue and alpha.
+	uint32_t* pixels;
+
+	float pixels_per_unit;
+	// Draw filled circles if set, otherwise outlines 1 pixel wide like render_world
+	int filled;
+	uint32_t background;
+	// Threads to draw with, or null to do everything on the calling thread.
+	WorkerPool* pool;
+
+	// The circles on screen this frame
+	RasterCircle* circles;
+	int circle_count;
+	int circle_capacity;
+	// The circles touching tile t are .tile_circles[.tile_start[t]] up to .tile_circles[.tile_start[t + 1]], tiles are row by row.
+	int tiles_x;
+	int tiles_y;
+	int* tile_start;
+	int* tile_circles;
+	int tile_circle_capacity;
+
+	// Space for converting frames to Y4M
+	uint8_t* yuv;
+} Rasterizer;
+
+// Pack a color into a pixel, the bytes in memory are always red, green, blue, alpha.
+uint32_t raster_rgba(uint8_t r, uint8_t g, uint8_t b, uint8_t a) {
+	uint8_t bytes[4] = {r, g, b, a};
+	uint32_t pixel;
+	memcpy(&pixel, bytes, 4);
+	return pixel;
+}
+
+// The color of an object, the same as render_world uses
+uint32_t raster_color(World* world, int i) {
+	unsigned int id = world->ids ? world->ids[i] : i;
+	int color = (id * 20 * id % 256);
+	return raster_rgba(color, 255-color, 255, 255);
+}
+
+// Allocate a rasterizer for width by height frames, call free_rasterizer when done.
+// pool can be null to draw on a single thread.
+Rasterizer new_rasterizer(int width, int height, float pixels_per_unit, WorkerPool* pool) {
+	int tiles_x = (width + RASTER_TILE_SIZE - 1) / RASTER_TILE_SIZE;
+	int tiles_y = (height + RASTER_TILE_SIZE - 1) / RASTER_TILE_SIZE;
+	Rasterizer r = {
+		.width = width,
+		.height = height,
+		.pixels = malloc((size_t)width * height * sizeof(uint32_t)),
+		.pixels_per_unit = pixels_per_unit,
+		.filled = 1,
+		.background = raster_rgba(0, 0, 0, 255),
+		.pool = pool,
+		.circles = 0,
+		.circle_count = 0,
+		.circle_capacity = 0,
+		.tiles_x = tiles_x,
+		.tiles_y = tiles_y,
+		.tile_start = malloc((tiles_x * tiles_y + 1) * sizeof(int)),
+		.tile_circles = 0,
+		.tile_circle_capacity = 0,
+		.yuv = 0
+	};
+	return r;
+}
+
+void free_rasterizer(Rasterizer* r) {
+	free(r->pixels);
+	free(r->circles);
+	free(r->tile_start);
+	free(r->tile_circles);
+	free(r->yuv);
+	r->pixels = 0;
+	r->circles = 0;
+	r->tile_start = 0;
+	r->tile_circles = 0;
+	r->yuv = 0;
+	r->circle_count = 0;
+	r->circle_capacity = 0;
+	r->tile_circle_capacity = 0;
+}
+
+// The range of tiles a circle touches, returns 0 if it is entirely off screen.
+int raster_circle_tiles(Rasterizer* r, RasterCircle* c, int* x0, int* y0, int* x1, int* y1) {
+	float minx = c->x - c->radius, maxx = c->x + c->radius;
+	float miny = c->y - c->radius, maxy = c->y + c->radius;
+	if (maxx < 0 || maxy < 0 || minx >= r->width || miny >= r->height) return 0;
+	*x0 = minx < 0 ? 0 : (int)minx / RASTER_TILE_SIZE;
+	*y0 = miny < 0 ? 0 : (int)miny / RASTER_TILE_SIZE;
+	*x1 = maxx >= r->width ? r->tiles_x - 1 : (int)maxx / RASTER_TILE_SIZE;
+	*y1 = maxy >= r->height ? r->tiles_y - 1 : (int)maxy / RASTER_TILE_SIZE;
+	return 1;
+}
+
+// Fill pixels start up to end of a row
+void raster_span(uint32_t* row, int start, int end, uint32_t color) {
+	for (int x = start; x < end; x++) row[x] = color;
+}
+
+// Draw one circle, only touching pixels between x0, y0 and x1, y1 (not including x1 and y1).
+// A pixel is drawn if it's center is inside the circle, for outlines, if it is inside the circle but not inside one a pixel smaller.
+void raster_circle(Rasterizer* r, RasterCircle* c, int x0, int y0, int x1, int y1) {
+	int start_y = ceilf(c->y - c->radius - 0.5);
+	int end_y = floorf(c->y + c->radius - 0.5) + 1;
+	if (start_y < y0) start_y = y0;
+	if (end_y > y1) end_y = y1;
+	float r2 = c->radius * c->radius;
+	float inner = c->radius - 1;
+	float inner2 = inner > 0 ? inner * inner : -1;
+
+	for (int y = start_y; y < end_y; y++) {
+		float dy = y + 0.5 - c->y;
+		float outer = r2 - dy * dy;
+		if (outer < 0) continue;
+		float half = sqrtf(outer);
+		int start = ceilf(c->x - half - 0.5);
+		int end = floorf(c->x + half - 0.5) + 1;
+		if (start < x0) start = x0;
+		if (end > x1) end = x1;
+		uint32_t* row = r->pixels + (size_t)y * r->width;
+
+		float hole = inner2 - dy * dy;
+		if (r->filled || hole < 0) {
+			raster_span(row, start, end, c->color);
+			continue;
+		}
+		// Leave out the inside of the circle
+		float inner_half = sqrtf(hole);
+		int hole_start = ceilf(c->x - inner_half - 0.5);
+		int hole_end = floorf(c->x + inner_half - 0.5) + 1;
+		if (hole_start < start) hole_start = start;
+		if (hole_end > end) hole_end = end;
+		if (hole_start >= hole_end) {
+			raster_span(row, start, end, c->color);
+		} else {
+			raster_span(row, start, hole_start, c->color);
+			raster_span(row, hole_end, end, c->color);
+		}
+	}
+}
+
+// Clear a tile and draw every circle in it
+void raster_tile_task(void* data, int tile) {
+	Rasterizer* r = data;
+	int tx = tile % r->tiles_x;
+	int ty = tile / r->tiles_x;
+	int x0 = tx * RASTER_TILE_SIZE;
+	int y0 = ty * RASTER_TILE_SIZE;
+	int x1 = x0 + RASTER_TILE_SIZE;
+	int y1 = y0 + RASTER_TILE_SIZE;
+	if (x1 > r->width) x1 = r->width;
+	if (y1 > r->height) y1 = r->height;
+
+	for (int y = y0; y < y1; y++) raster_span(r->pixels + (size_t)y * r->width, x0, x1, r->background);
+	for (int i = r->tile_start[tile]; i < r->tile_start[tile + 1]; i++) {
+		raster_circle(r, &r->circles[r->tile_circles[i]], x0, y0, x1, y1);
+	}
+}
+
+// Draw every object in a world into .pixels
+void rasterizer_draw_world(Rasterizer* r, World* world) {
+	if (world->size > r->circle_capacity) {
+		r->circle_capacity = world->size;
+		r->circles = realloc(r->circles, r->circle_capacity * sizeof(RasterCircle));
+	}
+
+	// Find every circle on screen, and count how many touch each tile
+	int tiles = r->tiles_x * r->tiles_y;
+	for (int t = 0; t <= tiles; t++) r->tile_start[t] = 0;
+	r->circle_count = 0;
+	for (int i = 0; i < world->size; i++) {
+		RasterCircle c = {
+			.x = (-world->objects[i].position.x * r->pixels_per_unit) + (r->width / 2),
+			.y = (-world->objects[i].position.y * r->pixels_per_unit) + (r->height / 2),
+			.radius = world->objects[i].radius * r->pixels_per_unit,
+			.color = raster_color(world, i)
+		};
+		int x0, y0, x1, y1;
+		if (!raster_circle_tiles(r, &c, &x0, &y0, &x1, &y1)) continue;
+		for (int ty = y0; ty <= y1; ty++) {
+			for (int tx = x0; tx <= x1; tx++) r->tile_start[ty * r->tiles_x + tx + 1]++;
+		}
+		r->circles[r->circle_count++] = c;
+	}
+	for (int t = 0; t < tiles; t++) r->tile_start[t + 1] += r->tile_start[t];
+
+	// Put the circles in the bins, in order, so tiles are drawn the same way every time
+	if (r->tile_start[tiles] > r->tile_circle_capacity) {
+		r->tile_circle_capacity = r->tile_start[tiles];
+		r->tile_circles = realloc(r->tile_circles, r->tile_circle_capacity * sizeof(int));
+	}
+	for (int i = 0; i < r->circle_count; i++) {
+		int x0, y0, x1, y1;
+		raster_circle_tiles(r, &r->circles[i], &x0, &y0, &x1, &y1);
+		for (int ty = y0; ty <= y1; ty++) {
+			for (int tx = x0; tx <= x1; tx++) r->tile_circles[r->tile_start[ty * r->tiles_x + tx]++] = i;
+		}
+	}
+	// Filling the bins moved every start to the end of the bin, which is the start of the next one
+	for (int t = tiles; t > 0; t--) r->tile_start[t] = r->tile_start[t - 1];
+	r->tile_start[0] = 0;
+
+	if (r->pool) {
+		worker_pool_run(r->pool, raster_tile_task, r, tiles);
+	} else {
+		for (int t = 0; t < tiles; t++) raster_tile_task(r, t);
+	}
+}
+
+////////////
+// Output //
+////////////
+
+// Write the frame as raw RGBA bytes, returns 1 if sucessfull.
+int raster_write_raw(FILE* file, Rasterizer* r) {
+	size_t count = (size_t)r->width * r->height;
+	return fwrite(r->pixels, sizeof(uint32_t), count, file) == count;
+}
+
+// Write the start of a Y4M video, call once before writing frames with raster_write_y4m_frame.
+int raster_write_y4m_header(FILE* file, Rasterizer* r, int fps) {
+	return fprintf(file, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", r->width, r->height, fps) > 0;
+}
+
+// Convert rows to YUV, with the colors subsampled in 2 by 2 blocks (4:2:0).
+// Uses the BT.601 limited range conversion, which is what video tools assume.
+void raster_yuv_task(void* data, int task) {
+	Rasterizer* r = data;
+	int width = r->width;
+	int chroma_width = (width + 1) / 2;
+	int chroma_height = (r->height + 1) / 2;
+	uint8_t* y_plane = r->yuv;
+	uint8_t* u_plane = y_plane + (size_t)width * r->height;
+	uint8_t* v_plane = u_plane + (size_t)chroma_width * chroma_height;
+
+	// Tasks are an even number of rows, so every pair of rows (one row of chroma) is done by a single task
+	int start = task * RASTER_ROWS_PER_TASK / 2;
+	int end = start + RASTER_ROWS_PER_TASK / 2;
+	if (end > chroma_height) end = chroma_height;
+	for (int cy = start; cy < end; cy++) {
+		// Repeat the last row or column if the size is odd
+		int y0 = cy * 2;
+		int y1 = y0 + 1 < r->height ? y0 + 1 : y0;
+		const uint8_t* row0 = (const uint8_t*)(r->pixels + (size_t)y0 * width);
+		const uint8_t* row1 = (const uint8_t*)(r->pixels + (size_t)y1 * width);
+		uint8_t* luma0 = y_plane + (size_t)y0 * width;
+		uint8_t* luma1 = y_plane + (size_t)y1 * width;
+		uint8_t* u_row = u_plane + (size_t)cy * chroma_width;
+		uint8_t* v_row = v_plane + (size_t)cy * chroma_width;
+
+		for (int x = 0; x < width; x++) {
+			const uint8_t* p0 = row0 + x * 4;
+			const uint8_t* p1 = row1 + x * 4;
+			luma0[x] = ((66 * p0[0] + 129 * p0[1] + 25 * p0[2] + 128) >> 8) + 16;
+			luma1[x] = ((66 * p1[0] + 129 * p1[1] + 25 * p1[2] + 128) >> 8) + 16;
+		}
+		for (int cx = 0; cx < chroma_width; cx++) {
+			int x0 = cx * 2;
+			int x1 = x0 + 1 < width ? x0 + 1 : x0;
+			// Average the 2 by 2 block
+			int red = (row0[x0*4] + row0[x1*4] + row1[x0*4] + row1[x1*4]) / 4;
+			int green = (row0[x0*4+1] + row0[x1*4+1] + row1[x0*4+1] + row1[x1*4+1]) / 4;
+			int blue = (row0[x0*4+2] + row0[x1*4+2] + row1[x0*4+2] + row1[x1*4+2]) / 4;
+			u_row[cx] = ((-38 * red - 74 * green + 112 * blue + 128) >> 8) + 128;
+			v_row[cx] = ((112 * red - 94 * green - 18 * blue + 128) >> 8) + 128;
+		}
+	}
+}
+
+// Write the frame to a Y4M video, returns 1 if sucessfull.
+int raster_write_y4m_frame(FILE* file, Rasterizer* r) {
+	size_t chroma = (size_t)((r->width + 1) / 2) * ((r->height + 1) / 2);
+	size_t size = (size_t)r->width * r->height + chroma * 2;
+	if (!r->yuv) r->yuv = malloc(size);
+
+	int tasks = (r->height + RASTER_ROWS_PER_TASK - 1) / RASTER_ROWS_PER_TASK;
+	if (r->pool) {
+		worker_pool_run(r->pool, raster_yuv_task, r, tasks);
+	} else {
+		for (int t = 0; t < tasks; t++) raster_yuv_task(r, t);
+	}
+
+	if (fputs("FRAME\n", file) < 0) return 0;
+	return fwrite(r->yuv, 1, size, file) == size;
+}
+
+#endif
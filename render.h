@@ -0,0 +1,96 @@
+// Drawing worlds with SDL, kept seperate from the physics engine so physics.h doesn't depend on SDL.
+//
+// The view is centered on the origin, with pixels_per_unit setting the zoom. The engine's y axis points up, so everything is flipped to match the screen.
+
+#ifndef HAS_RENDER
+#define HAS_RENDER 1
+
+#include <SDL2/SDL.h>
+#include "shape.h"
+#include "physics.h"
+
+// Where a view is looking, and how zoomed in it is.
+typedef struct View {
+	int screen_width;
+	int screen_height;
+	float pixels_per_unit;
+} View;
+
+// Convert world cordinates to a position on screen
+SDL_Point view_to_screen(View* view, Vector2 position) {
+	SDL_Point point = {
+		.x = (-position.x * view->pixels_per_unit) + (view->screen_width / 2),
+		.y = (-position.y * view->pixels_per_unit) + (view->screen_height / 2)
+	};
+	return point;
+}
+
+// Convert a position on screen to world cordinates, for example to find where the mouse is.
+Vector2 view_to_world(View* view, int x, int y) {
+	Vector2 position = {
+		.x = -((float)x - view->screen_width / 2) / view->pixels_per_unit,
+		.y = -((float)y - view->screen_height / 2) / view->pixels_per_unit
+	};
+	return position;
+}
+
+// Where on screen a circle is, and it's size in pixels. Returns 0 if it is entirely off screen.
+int view_circle(View* view, Body* object, SDL_Point* center, int* r) {
+	*center = view_to_screen(view, object->position);
+	*r = object->radius * view->pixels_per_unit;
+	return center->x + *r >= 0 && center->x - *r < view->screen_width
+		&& center->y + *r >= 0 && center->y - *r < view->screen_height;
+}
+
+// The color of an object, based on it's id, so colors don't change if the world is reordered.
+int render_color(World* world, int i) {
+	unsigned int id = world->ids ? world->ids[i] : i;
+	// Unsigned so large ids wrap around instead of going negative
+	return (id * 20 * id % 256);
+}
+
+// Draw the outline of every object in a world, using cache for the shapes of the circles.
+// Objects off screen are skipped, and the points of every object with the same color are drawn with a single call.
+// There are only a few dozen colors, so this is a few dozen draw calls no matter how many objects there are.
+void render_world_cached(SDL_Renderer* renderer, View* view, World* world, CircleCache* cache) {
+	// Count the points of each color, and find where each color starts in the buffer
+	int next[257] = {0};
+	for (int i = 0; i < world->size; i++) {
+		SDL_Point center;
+		int r, count;
+		if (!view_circle(view, &world->objects[i], &center, &r)) continue;
+		circle_cache_get(cache, r, &count);
+		next[render_color(world, i) + 1] += count;
+	}
+	for (int color = 0; color < 256; color++) next[color + 1] += next[color];
+	SDL_Point* points = circle_cache_reserve(cache, next[256]);
+
+	int start[257];
+	for (int color = 0; color <= 256; color++) start[color] = next[color];
+	for (int i = 0; i < world->size; i++) {
+		SDL_Point center;
+		int r, count;
+		if (!view_circle(view, &world->objects[i], &center, &r)) continue;
+		SDL_Point* offsets = circle_cache_get(cache, r, &count);
+		SDL_Point* out = points + next[render_color(world, i)];
+		for (int p = 0; p < count; p++) {
+			out[p].x = center.x + offsets[p].x;
+			out[p].y = center.y + offsets[p].y;
+		}
+		next[render_color(world, i)] += count;
+	}
+
+	for (int color = 0; color < 256; color++) {
+		int count = start[color + 1] - start[color];
+		if (count == 0) continue;
+		SDL_SetRenderDrawColor(renderer, color, 255-color, 255, 255);
+		SDL_RenderDrawPoints(renderer, points + start[color], count);
+	}
+}
+
+// Draw the outline of every object in a world, each object gets a color based on it's id, so colors don't change if the world is reordered.
+void render_world(SDL_Renderer* renderer, View* view, World* world) {
+	render_world_cached(renderer, view, world, &default_circle_cache);
+}
+
+#endif
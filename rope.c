@@ -3,8 +3,9 @@
 #include <stdlib.h>
 #include <stdio.h>
 
-#include "shape.h"
+#include "render.h"
 #include "physics.h"
+#include "physics_constraints.h"
 #include <SDL2/SDL.h>
 
 #define SCREEN_WIDTH 1500
@@ -13,6 +14,31 @@
 
 #define OBJECT_RADIUS 0.4
 
+// The constraints limiting distance between objects are run multiple times to improve rigity.
+#define ROPE_ITERATIONS 10
+
+typedef struct Rope {
+	// Each object is attached to the one added before it
+	DistanceConstraints constraints;
+	float dt;
+} Rope;
+
+// Run once every timestep by world_step, before collisions
+void step_begin_rope(World* w, void* data) {
+	Rope* rope = data;
+	distance_constraints_begin_step(&rope->constraints, rope->dt);
+}
+
+// Run by world_step after collisions
+void step_constrain_rope(World* w, void* data) {
+	Rope* rope = data;
+	for (int steps = 0; steps < ROPE_ITERATIONS; steps++) {
+		distance_constraints_solve(w, &rope->constraints);
+		// The first object is the end of the rope, which is held in place
+		if (w->size > 0) constrain_distance_from_point(w, 0, 0, 0, 0);
+	}
+}
+
 /////////////////////////////
 // The main function       //
 /////////////////////////////
@@ -36,26 +62,26 @@ int main() {
 		return 1;
 	}
 
+	View view = {.screen_width = SCREEN_WIDTH, .screen_height = SCREEN_HEIGHT, .pixels_per_unit = PIXELS_PER_UNIT};
+
 	// Setup physics engine
 	World world = world_with_capacity(1024);
-
-	float dt = 1.0/60;
+	Rope rope = {.constraints = distance_constraints_with_capacity(1024), .dt = 1.0/60};
+
+	StepSettings settings = {
+		.substeps = 1,
+		.dt = rope.dt,
+		.gravity = 9.8,
+		.collision_iterations = 1,
+		.broad_phase = step_begin_rope,
+		.broad_phase_data = &rope,
+		.constrain = step_constrain_rope,
+		.constrain_data = &rope,
+	};
 	
 	// Run simulation
 	while (1) {
-		world_update_positions(&world, dt);
-	
-		// Apply constraits. The constaints limiting distance between objects are run multiple times to improve rigity.
-		world_collide(&world);
-		for (int steps = 0; steps < 10; steps++) {
-			for (int i = 0; i < world.size - 1; i++) {
-				constrain_distance_between_objects(&world, i, i+1, 1);
-			}
-			constrain_distance_from_point(&world, 0, 0, 0, 0);
-		}
-
-		// Step physics
-		world_apply_gravity(&world, 9.8);
+		world_step(&world, &settings);
 
 		// Check for input
 		SDL_Event event;
@@ -68,6 +94,8 @@ int main() {
 					float x = -((float)event.button.x - SCREEN_WIDTH/2) / PIXELS_PER_UNIT;
 					float y = -((float)event.button.y - SCREEN_HEIGHT/2) / PIXELS_PER_UNIT;
 					world_spawn(&world, x, y, OBJECT_RADIUS);
+					if (world.size > 1)
+						distance_constraints_add(&rope.constraints, &world, world.size - 2, world.size - 1, 1);
 				default:
 					break;
 			}
@@ -77,21 +105,12 @@ int main() {
 		SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
 		SDL_RenderClear(renderer);
 
-		for (int i = 0; i < world.size; i++) {
-
-			int color = (i * 20 * i % 256);
-
-			SDL_SetRenderDrawColor(renderer, color, 255-color, 255, 255);
-			int x = (-world.objects[i].position.x * PIXELS_PER_UNIT) + (SCREEN_WIDTH/2);
-			int y = (-world.objects[i].position.y * PIXELS_PER_UNIT) + (SCREEN_HEIGHT/2);
-			int r = (world.objects[i].radius * PIXELS_PER_UNIT);
-		
-			draw_circle(renderer, x, y, r);
-		}
+		render_world(renderer, &view, &world);
 
 		SDL_RenderPresent(renderer);
 	}
 	
 
+	distance_constraints_free(&rope.constraints);
 	world_cleanup(&world);
 }
@@ -1,3 +1,9 @@
+// Circle drawing with SDL, see render.h for drawing a whole world.
+
+#ifndef HAS_SHAPE
+#define HAS_SHAPE 1
+
+#include <stdlib.h>
 #include <SDL2/SDL.h>
 
 void draw_circle(SDL_Renderer* renderer, int32_t centreX, int32_t centreY, int32_t radius) {
@@ -33,16 +39,10 @@ void draw_circle(SDL_Renderer* renderer, int32_t centreX, int32_t centreY, int32
 	}
 }
 
-int round_up_to_multiple_of_8(int v) {
-    return (v + (8 - 1)) & -8;
-}
-
-void draw_circle_fast( SDL_Renderer * renderer, int cx, int cy, int radius) {
-	// 35 / 49 is a slightly biased approximation of 1/sqrt(2)
-	int arrSize = round_up_to_multiple_of_8( radius * 8 * 35 / 49 );
-	SDL_Point points[arrSize];
-	int drawCount = 0;
-
+// Rasterize the outline of a circle centered on 0, 0, giving the same points as draw_circle.
+// Writes them to points if it isn't null, returns the number of points.
+int circle_rasterize(SDL_Point* points, int32_t radius) {
+	int count = 0;
 	const int32_t diameter = (radius * 2);
 
 	int32_t x = (radius - 1);
@@ -51,29 +51,107 @@ void draw_circle_fast( SDL_Renderer * renderer, int cx, int cy, int radius) {
 	int32_t ty = 1;
 	int32_t error = (tx - diameter);
 
-	while( x >= y ) {
-		// Each of the following renders an octant of the circle
-		points[drawCount+0].x = cx + x; points[drawCount+0].y = cy - y;
-		points[drawCount+1].x = cx + x; points[drawCount+1].y = cy + y;
-		points[drawCount+2].x = cx - x; points[drawCount+2].y = cy - y;
-		points[drawCount+3].x = cx - x; points[drawCount+3].y = cy + y;
-		points[drawCount+4].x = cx + y; points[drawCount+4].y = cy - x;
-		points[drawCount+5].x = cx + y; points[drawCount+5].y = cy + x;
-		points[drawCount+6].x = cx - y; points[drawCount+6].y = cy - x;
-		points[drawCount+7].x = cx - y; points[drawCount+7].y = cy + x;
-
-		drawCount += 8;
-
-		if( error <= 0 ) {
+	while (x >= y) {
+		if (points) {
+			// Each of the following is an octant of the circle
+			points[count+0].x = x; points[count+0].y = -y;
+			points[count+1].x = x; points[count+1].y = y;
+			points[count+2].x = -x; points[count+2].y = -y;
+			points[count+3].x = -x; points[count+3].y = y;
+			points[count+4].x = y; points[count+4].y = -x;
+			points[count+5].x = y; points[count+5].y = x;
+			points[count+6].x = -y; points[count+6].y = -x;
+			points[count+7].x = -y; points[count+7].y = x;
+		}
+		count += 8;
+
+		if (error <= 0) {
 			++y;
 			error += ty;
 			ty += 2;
 		}
-		if( error > 0 ) {
+		if (error > 0) {
 			--x;
 			tx += 2;
 			error += (tx - diameter);
 		}
 	}
-	SDL_RenderDrawPoints(renderer, points, drawCount);
+	return count;
+}
+
+// Circles rasterized once per radius and reused, and a buffer for collecting points to draw in one call.
+typedef struct CircleCache {
+	// .offsets[r] is the .counts[r] points of a circle of radius r, or null if that radius hasn't been used yet.
+	SDL_Point** offsets;
+	int* counts;
+	int radius_capacity;
+	// Space for points waiting to be drawn
+	SDL_Point* points;
+	int point_capacity;
+} CircleCache;
+
+// The cache used by draw_circle_fast and render_world
+CircleCache default_circle_cache = {0};
+
+// Get the points of a circle of radius r, rasterizing it if this is the first time that radius is used.
+SDL_Point* circle_cache_get(CircleCache* cache, int radius, int* count) {
+	if (radius < 1) {
+		*count = 0;
+		return 0;
+	}
+	if (radius >= cache->radius_capacity) {
+		int capacity = cache->radius_capacity * 2;
+		if (capacity <= radius) capacity = radius + 1;
+		cache->offsets = realloc(cache->offsets, capacity * sizeof(SDL_Point*));
+		cache->counts = realloc(cache->counts, capacity * sizeof(int));
+		for (int r = cache->radius_capacity; r < capacity; r++) {
+			cache->offsets[r] = 0;
+			cache->counts[r] = 0;
+		}
+		cache->radius_capacity = capacity;
+	}
+	if (!cache->offsets[radius]) {
+		cache->counts[radius] = circle_rasterize(0, radius);
+		cache->offsets[radius] = malloc(cache->counts[radius] * sizeof(SDL_Point));
+		circle_rasterize(cache->offsets[radius], radius);
+	}
+	*count = cache->counts[radius];
+	return cache->offsets[radius];
+}
+
+// Make sure the point buffer has space for count points, and return it.
+SDL_Point* circle_cache_reserve(CircleCache* cache, int count) {
+	if (count > cache->point_capacity) {
+		int capacity = cache->point_capacity * 2;
+		if (capacity < count) capacity = count;
+		cache->points = realloc(cache->points, capacity * sizeof(SDL_Point));
+		cache->point_capacity = capacity;
+	}
+	return cache->points;
 }
+
+void free_circle_cache(CircleCache* cache) {
+	for (int r = 0; r < cache->radius_capacity; r++) free(cache->offsets[r]);
+	free(cache->offsets);
+	free(cache->counts);
+	free(cache->points);
+	cache->offsets = 0;
+	cache->counts = 0;
+	cache->points = 0;
+	cache->radius_capacity = 0;
+	cache->point_capacity = 0;
+}
+
+// Same as draw_circle, but with a single draw call.
+void draw_circle_fast(SDL_Renderer* renderer, int cx, int cy, int radius) {
+	int count;
+	SDL_Point* offsets = circle_cache_get(&default_circle_cache, radius, &count);
+	SDL_Point* points = circle_cache_reserve(&default_circle_cache, count);
+	for (int i = 0; i < count; i++) {
+		points[i].x = cx + offsets[i].x;
+		points[i].y = cy + offsets[i].y;
+	}
+	SDL_RenderDrawPoints(renderer, points, count);
+}
+
+#endif
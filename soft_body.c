@@ -3,10 +3,10 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <SDL2/SDL.h>
-#include <assert.h>
 
-#include "shape.h"
+#include "render.h"
 #include "physics.h"
+#include "physics_constraints.h"
 
 #define SCREEN_WIDTH 1500
 #define SCREEN_HEIGHT 1200
@@ -15,73 +15,15 @@
 #define OBJECT_RADIUS 0.2
 #define CONSTRAINT_RADIUS 0.5
 #define STRAIN_THRESHOLD 10
-
-///////////////////////////////
-// Constraint array handling //
-///////////////////////////////
-
-typedef struct Constraint {
-	int broken;
-	int idx1;
-	int idx2;
-} Constraint;
-
-typedef struct Constraints {
-	Constraint* constraints;
-	int size;
-	int capacity;
-} Constraints;
-
-int add_constraint(Constraints* c, int idx1, int idx2) {
-	Constraint constraint = { .idx1 = idx1, .idx2 = idx2, .broken = 0};
-	if (c->capacity > c->size) {
-		c->constraints[c->size] = constraint;
-		c->size++;
-		return 1;
-	} else {
-		return 0;
-	}
-}
-
-Constraints constraints_with_capacity(int capacity) {
-	Constraints c = {
-		.constraints = malloc(capacity * sizeof(Constraint)),
-		.size = 0,
-		.capacity = capacity
-	};
-	return c;
-}
-
-void constraints_free(Constraints c) {
-	free(c.constraints);
-	c.constraints = 0;
-	c.size = 0;
-	c.capacity = 0;
-}
-
-void constraints_apply(World* w, Constraints* c, float dt) {
-	for (int i = 0; i < c->size; i++) {
-		int idx1 = c->constraints[i].idx1;
-		int idx2 = c->constraints[i].idx2;
-		assert(idx1 >= 0 && w->size > idx1);
-		assert(idx2 >= 0 && w->size > idx2);
-		if (!c->constraints[i].broken) {
-			Vector2 preconstrain1 = w->objects[idx1].position;
-			constrain_distance_between_objects(w, idx1, idx2, CONSTRAINT_RADIUS);
-			float distance = vector_length(vector_sub(w->objects[idx1].position, preconstrain1));
-			if ((distance / (dt)) > STRAIN_THRESHOLD) {
-				c->constraints[i].broken = 1;
-			}
-		}
-	}
-}
+// How soft the constraints are, 0 is rigid
+#define CONSTRAINT_COMPLIANCE 0.0001
 
 /////////////////////
 // Object spawning //
 /////////////////////
 
 void create_rope(
-	World* w, Constraints* c,
+	World* w, DistanceConstraints* c,
 	int count,
 	float startx, float starty,
 	float xoffset, float yoffset
@@ -91,14 +33,14 @@ void create_rope(
 	for (int i = 0; i < count; i++) {
 		world_spawn(w, x, y, OBJECT_RADIUS);
 		if (i != 0)
-			add_constraint(c, w->size-2, w->size-1);
+			c->compliance[distance_constraints_add(c, w, w->size-2, w->size-1, CONSTRAINT_RADIUS)] = CONSTRAINT_COMPLIANCE;
 		x += xoffset;
 		y += yoffset;
 	}	
 }
 
 void create_cloth(
-	World* w, Constraints* c,
+	World* w, DistanceConstraints* c,
 	int xcount, int ycount,
 	float startx, float starty,
 	float seperation
@@ -109,10 +51,10 @@ void create_cloth(
 		for (int iy = 0; iy < ycount; iy++) {
 			world_spawn(w, x, y, OBJECT_RADIUS);
 			if (ix!=0) {
-				add_constraint(c, w->size - 1, w->size - 1 - ycount);
+				c->compliance[distance_constraints_add(c, w, w->size - 1, w->size - 1 - ycount, CONSTRAINT_RADIUS)] = CONSTRAINT_COMPLIANCE;
 			}
 			if (iy!=0) {
-				add_constraint(c, w->size - 1, w->size - 2);
+				c->compliance[distance_constraints_add(c, w, w->size - 1, w->size - 2, CONSTRAINT_RADIUS)] = CONSTRAINT_COMPLIANCE;
 			}
 			x += seperation;
 		}
@@ -126,10 +68,11 @@ void create_cloth(
 // UI Helpers              //
 /////////////////////////////
 
+// Returns the id of the object at a point
 int get_object_at_point(World* w, Vector2 point) {
 	for (int i = 0; i < w->size; i++) {
 		if (vector_length(vector_sub(point, w->objects[i].position)) <= w->objects[i].radius) {
-			return i;
+			return w->ids[i];
 		}
 	}
 }
@@ -156,15 +99,19 @@ int main() {
 		return 1;
 	}
 
+	View view = {.screen_width = SCREEN_WIDTH, .screen_height = SCREEN_HEIGHT, .pixels_per_unit = PIXELS_PER_UNIT};
+
 	// Setup physics engine
 	World world = world_with_capacity(1024);
-	Constraints constraints = constraints_with_capacity(1024);
+	DistanceConstraints constraints = distance_constraints_with_capacity(1024);
 
 	create_cloth(&world, &constraints, 20, 20, 5, 5, -0.5);
 //	create_rope(&world, &constraints, 10, -6, 0, 0, -1);
 	world_spawn(&world, -10, -10, 1);
 
 	float dt = 1.0/60;
+	// Constraints break if they are strained too fast
+	constraints.break_distance = STRAIN_THRESHOLD * dt;
 	
 	int held_object = 0;
 	int is_mouse_down = 0;
@@ -174,24 +121,25 @@ int main() {
 	while (1) {
 		world_update_positions(&world, dt);
 		world_apply_gravity(&world, 9.8);
+		distance_constraints_begin_step(&constraints, dt);
 
 		// Apply constraits
-		for (int steps = 0; steps < 4; steps++) {
+		for (int steps = 0; steps < 2; steps++) {
 			world_collide(&world);
-			constraints_apply(&world, &constraints, dt);
+			distance_constraints_solve(&world, &constraints);
                 	for (int i = 0; i < world.size; i++) {
 				constrain_bounding_box(&world, i, -10, 10, -10, 10);
 	                }
 
                 	for (int y = 0; y < 20; y++) {
 				int x = 0;
-        	                constrain_distance_from_point(&world, x * 10 + y, 5-((float)y/2), 5, 0);
+        	                constrain_distance_from_point(&world, world_body_index(&world, x * 10 + y), 5-((float)y/2), 5, 0);
 			}
 	
 			if (is_mouse_down) {
         	                constrain_distance_from_point(
 					&world,
-					held_object,
+					world_body_index(&world, held_object),
 					mouse_position.x, mouse_position.y,
 					0);
 			}
@@ -226,21 +174,12 @@ int main() {
 		SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
 		SDL_RenderClear(renderer);
 
-		for (int i = 0; i < world.size; i++) {
-			int color = (i * 20 * i % 256);
-
-			SDL_SetRenderDrawColor(renderer, color, 255-color, 255, 255);
-			int x = (-world.objects[i].position.x * PIXELS_PER_UNIT) + (SCREEN_WIDTH/2);
-			int y = (-world.objects[i].position.y * PIXELS_PER_UNIT) + (SCREEN_HEIGHT/2);
-			int r = (world.objects[i].radius * PIXELS_PER_UNIT);
-		
-			draw_circle(renderer, x, y, r);
-			
-		}
+		render_world(renderer, &view, &world);
 
 		SDL_RenderPresent(renderer);
 	}
 	
 
+	distance_constraints_free(&constraints);
 	world_cleanup(&world);
 }
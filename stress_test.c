@@ -1,11 +1,15 @@
 // Click on the window to add objects, objects are confined to a circle in the midle of the window.
+// Press S to save the simulation to stress_test.snapshot, run with the name of a snapshot file to start from it.
+// The simulation runs on it's own thread, so drawing the last step doesn't slow down the next one.
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <SDL2/SDL.h>
 
-#include "shape.h"
-#include "physics_optimized.h"
+#include "render.h"
+#include "physics_threaded.h"
+#include "physics_snapshot.h"
+#include "physics_pipeline.h"
 
 #define SCREEN_WIDTH 1500
 #define SCREEN_HEIGHT 1200
@@ -14,13 +18,106 @@
 #define TIMESTEP (1.0/60/3)
 #define SPAWN_DELAY 2
 #define SPAWN_Y 19
-#define MAX_COUNT 20000
+#define INITIAL_CAPACITY 1024
+#define SPAWN_COUNT 30
+#define THREADS 4
+#define SORT_DELAY 60
+#define SNAPSHOT_FILE "stress_test.snapshot"
+// How many steps to run per second of real time, each step is 1/60 seconds of simulated time
+#define TICKS_PER_SECOND 60
+
+/////////////////////////////
+// The simulation thread   //
+/////////////////////////////
+
+typedef struct Simulation {
+	World world;
+	AccessGrid grid;
+	StepSettings settings;
+	FrameBuffers* frames;
+	// Set by the main thread, read by the simulation thread
+	int quit;
+	int save_requested;
+} Simulation;
+
+void* simulation_thread(void* data) {
+	Simulation* sim = data;
+	World* world = &sim->world;
+	int tick = 0;
+	int last_realtime_count = 0;
+	// Steps are paced from a fixed starting point, 1000 / 60 ms isn't a whole number so waiting a rounded amount every step would drift
+	int paced_since = SDL_GetTicks();
+	int paced_ticks = 0;
+
+	while (!__atomic_load_n(&sim->quit, __ATOMIC_RELAXED)) {
+		int start_ms = SDL_GetTicks();
+		world_step(world, &sim->settings);
+		int end_ms = SDL_GetTicks();
+		printf("%d Objects, %d simulation ms\n", world->size, end_ms-start_ms);
+#ifdef PHYSICS_STATS
+		// Compile with -DPHYSICS_STATS to see what the solver is doing
+		printf("  %lld pairs tested, %lld contacts, %lld cells, %lld moved in grid, %lld grid rebuilds\n",
+			physics_stats.pairs_tested, physics_stats.contacts_resolved, physics_stats.cells_visited,
+			physics_stats.grid_objects_moved, physics_stats.grid_rebuilds);
+		printf("  integrate %lld us, broad phase %lld us, collide %lld us\n",
+			physics_stats.integrate_ns / 1000, physics_stats.broad_phase_ns / 1000, physics_stats.collide_ns / 1000);
+		physics_stats_reset();
+#endif
+		// Same as end_ms - start_ms > 1000 / 60, without rounding
+		if((end_ms - start_ms) * TICKS_PER_SECOND > 1000) {
+			printf("Not realtime! Last realtime object count: %d\n", last_realtime_count);
+		} else {
+			last_realtime_count = world->size;
+		}
+
+		// Keep objects that are close to each other close in memory
+		if (tick % SORT_DELAY == 0) {
+			world_spatial_sort(world, &sim->grid);
+		}
+
+		if (tick % SPAWN_DELAY == 0) {
+			float spawn_x[SPAWN_COUNT], spawn_y[SPAWN_COUNT], spawn_r[SPAWN_COUNT];
+			for (int i = 0; i < SPAWN_COUNT; i++) {
+				spawn_x[i] = i - 15;
+				spawn_y[i] = SPAWN_Y;
+				spawn_r[i] = 0.1;
+			}
+			int first = world->size;
+			int count = world_spawn_batch(world, SPAWN_COUNT, spawn_x, spawn_y, spawn_r);
+			// Give the new objects some velocity
+			for (int i = first; i < first + count; i++) {
+				world->objects[i].position.x -= 0.04;
+				world->objects[i].position.y -= 0.04;
+			}
+		}
+		tick++;
+
+		if (__atomic_exchange_n(&sim->save_requested, 0, __ATOMIC_RELAXED)) {
+			if (snapshot_save(SNAPSHOT_FILE, world, &sim->grid, 0)) printf("Saved to %s\n", SNAPSHOT_FILE);
+			else printf("Saving to %s failed\n", SNAPSHOT_FILE);
+		}
+
+		// Hand the step over to be drawn, then wait until this step should be done so the simulation runs in real time
+		if (!frame_buffers_publish(sim->frames, world)) printf("Out of memory, could not copy the step to be drawn\n");
+		paced_ticks++;
+		int deadline = paced_since + (long long)paced_ticks * 1000 / TICKS_PER_SECOND;
+		int now = SDL_GetTicks();
+		if (deadline > now) {
+			SDL_Delay(deadline - now);
+		} else if (now - deadline > 1000 / TICKS_PER_SECOND) {
+			// More than a step behind, start pacing from now instead of running steps back to back to catch up
+			paced_since = now;
+			paced_ticks = 0;
+		}
+	}
+	return 0;
+}
 
 /////////////////////////////
 // The main function       //
 /////////////////////////////
 
-int main() {
+int main(int argc, char** argv) {
 	
 	// Setup window
 	int rendererFlags = SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC;
@@ -39,53 +136,65 @@ int main() {
 		return 1;
 	}
 
-	// Setup physics engine
-	AccessGrid grid = new_access_grid(42*4, 42*4, -21, -21, 0.25);
-	World world = world_with_capacity(MAX_COUNT);
+	View view = {.screen_width = SCREEN_WIDTH, .screen_height = SCREEN_HEIGHT, .pixels_per_unit = PIXELS_PER_UNIT};
 
-	float dt = TIMESTEP;
-	int tick = 0;
-	int last_realtime_count = 0;
-	
-	// Run simulation
-	while (1) {
-		int start_ms = SDL_GetTicks();
-		for (int i = 0; i <3; i++) {
-			world_update_positions(&world, dt);
-			world_optimized_collide(&world, &grid);
-			world_optimized_collide(&world, &grid);
-//			world_collide(&world);
-		
-			for (int i = 0; i < world.size; i++) {
-				constrain_bounding_box(&world, i, -20, 20, -20, 20);
-			}
-		
-			world_apply_gravity(&world, 9.8);
-		}
-		int end_ms = SDL_GetTicks();
-		printf("%d Objects, %d simulation ms\n", world.size, end_ms-start_ms);
-		if(end_ms - start_ms > 16) {
-			printf("Not realtime! Last realtime object count: %d\n", last_realtime_count);
-		} else {
-			last_realtime_count = world.size;
+	// Setup physics engine
+	Simulation sim = {0};
+	sim.grid = new_access_grid(42*4, 42*4, -21, -21, 0.25);
+	sim.world = world_with_capacity(INITIAL_CAPACITY);
+	if (argc > 1) {
+		Snapshot snapshot;
+		if (!snapshot_open(argv[1], &snapshot)) {
+			printf("Could not load snapshot %s\n", argv[1]);
+			return 1;
 		}
-
-		if (tick % SPAWN_DELAY == 0) {
-			for (float x = -15; x < 15; x++) {
-				Body object = physics_new_with_position(x, SPAWN_Y, 0.1);
-				object.position.x -= 0.04;
-				object.position.y -= 0.04;
-				world_insert_object(&world, object);
-			}
+		world_cleanup(&sim.world);
+		sim.world = snapshot_load_world(&snapshot);
+		// Use the grid the snapshot was saved with, in case it covers a diffrent area
+		AccessGrid grid;
+		if (snapshot_load_grid(&snapshot, &grid)) {
+			free_access_grid(&sim.grid);
+			sim.grid = grid;
 		}
-		tick++;
-
+		snapshot_close(&snapshot);
+	}
+	// Put objects that have settled into the pile to sleep
+	sim.world.sleep_threshold = 0.001;
+	sim.world.sleep_delay = 30;
+	WorkerPool* pool = new_worker_pool(THREADS);
+
+	ThreadedCollide collide = {.grid = &sim.grid, .pool = pool};
+	StepSettings settings = {
+		.substeps = 3,
+		.dt = TIMESTEP,
+		.gravity = 9.8,
+		.boundary = boundary_box(-20, 20, -20, 20),
+		.collision_iterations = 2,
+		// Update the grid once per substep, only moving objects that changed cells, and share it between the collision iterations
+		.broad_phase = step_update_grid,
+		.broad_phase_data = &sim.grid,
+		// Use step_grid_collide with &grid for the single threaded solver, or leave these unset for world_collide
+		.collide = step_threaded_grid_collide,
+		.collide_data = &collide,
+	};
+	sim.settings = settings;
+	sim.frames = new_frame_buffers(INITIAL_CAPACITY);
+
+	pthread_t thread;
+	pthread_create(&thread, 0, simulation_thread, &sim);
+
+	// Draw whatever the simulation finished last, until the window is closed
+	int running = 1;
+	while (running) {
 		// Check for input
 		SDL_Event event;
 		while (SDL_PollEvent(&event)) {
 			switch (event.type) {
 				case SDL_QUIT:
-					return 0;
+					running = 0;
+					break;
+				case SDL_KEYDOWN:
+					if (event.key.keysym.sym == SDLK_s) __atomic_store_n(&sim.save_requested, 1, __ATOMIC_RELAXED);
 					break;
 				default:
 					break;
@@ -96,22 +205,16 @@ int main() {
 		SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
 		SDL_RenderClear(renderer);
 
-		for (int i = 0; i < world.size; i++) {
-			int color = (i * 20 * i % 256);
+		render_world(renderer, &view, frame_buffers_latest(sim.frames));
 
-			SDL_SetRenderDrawColor(renderer, color, 255-color, 255, 255);
-			int x = (-world.objects[i].position.x * PIXELS_PER_UNIT) + (SCREEN_WIDTH/2);
-			int y = (-world.objects[i].position.y * PIXELS_PER_UNIT) + (SCREEN_HEIGHT/2);
-			int r = (world.objects[i].radius * PIXELS_PER_UNIT);
-		
-			draw_circle(renderer, x, y, r);
-			
-		}
-		
 		SDL_RenderPresent(renderer);
 	}
-	
 
-	free_access_grid(&grid);
-	world_cleanup(&world);
+	__atomic_store_n(&sim.quit, 1, __ATOMIC_RELAXED);
+	pthread_join(thread, 0);
+
+	free_frame_buffers(sim.frames);
+	free_worker_pool(pool);
+	free_access_grid(&sim.grid);
+	world_cleanup(&sim.world);
 }